@@ -8,47 +8,31 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <cctype>
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <vector>
 #include <map>
+#include <thread>
+#include <climits>
+#include <strings.h>
+#include <sys/stat.h>
 
 #include "algo.h"
 #include "utility.h"
 #include "taxonomy.h"
 #include "globals.h"
+#include "dbimage.h"
+#include "textscan.h"
+#include "scheduler.h"
+#include "scorekernel.h"
 
 using namespace std;
 
 
-Sequence *newSequence(){
-	Sequence *seq = callocOrExit(1, Sequence);
-	seq->seqName.clear();
-	seq->genes.clear();
-	seq->seqTaxonForest.clear();
-	return seq;
-}
-
-Gene *newGene(){
-	Gene *gene = callocOrExit(1, Gene);
-	gene->gis.clear();
-	gene->identity.clear();
-	gene->bitscore.clear();
-	gene->clusters.clear();
-	gene->taxonIDs.clear();
-	gene->dualHist.clear();
-	gene->subMTX.clear();
-	
-	return gene;
-}
-
-PathNode *newPathNode(){
-	PathNode *pNode = callocOrExit(1, PathNode);
-	return pNode;
-}
-
 // get the Nth column of a given string (tab delimited);
 vector<string> &split(string s, char delim, vector<string> &elems) {
     stringstream ss(s);
@@ -67,633 +51,1390 @@ vector<string> split(string s, char delim) {
 }
 
 // structure functions
-void Sequence::printSeq(){
+void Sequence::printSeq(const QueryBatch &batch){
 	cout << "Query sequence ID: " << seqName << endl;
-	for(unsigned int i = 0; i < genes.size(); i++){
+	for(unsigned int i = 0; i < numGenes; i++){
+		unsigned int geneEnd = (i + 1 < numGenes)?batch.geneStarts[firstGene + i + 1]:firstHit + numHits;
 		cout << "  Gene " << i << endl;
-		for(unsigned int j = 0; j < genes[i].gis.size(); j++){
-			cout << " " << genes[i].gis[j] << " ";
-			cout << " " << genes[i].identity[j] << " ";
-			cout << " " << genes[i].bitscore[j] << " ";
-			cout << " " << genes[i].taxonIDs[j] << " ";
-			cout << " " << genes[i].dualHist[3*j] << ":";
-			cout << " " << genes[i].dualHist[3*j+1] << ":";
-			cout << " " << genes[i].dualHist[3*j+2] << " ";
-			cout << " " << genes[i].subMTX[3*j] << ":";
-			cout << " " << genes[i].subMTX[3*j+1] << ":";
-			cout << " " << genes[i].subMTX[3*j+2] << endl;
+		for(unsigned int j = batch.geneStarts[firstGene + i]; j < geneEnd; j++){
+			cout << " " << batch.gis[j] << " ";
+			cout << " " << batch.identity[j] << " ";
+			cout << " " << batch.bitscore[j] << " ";
+			cout << " " << batch.taxonIDs[j] << " ";
+			cout << " " << batch.dualHist[3*j] << ":";
+			cout << " " << batch.dualHist[3*j+1] << ":";
+			cout << " " << batch.dualHist[3*j+2] << " ";
+			cout << " " << batch.subMTX[3*j] << ":";
+			cout << " " << batch.subMTX[3*j+1] << ":";
+			cout << " " << batch.subMTX[3*j+2] << endl;
 		}
 	}
 	cout << "----------------------" << endl;
 }
 
+void clearQueryBatch(QueryBatch &QuerySeq){
+	QuerySeq.seqs.clear();
+	QuerySeq.geneStarts.clear();
+	QuerySeq.gis.clear();
+	QuerySeq.identity.clear();
+	QuerySeq.bitscore.clear();
+	QuerySeq.taxonIDs.clear();
+	QuerySeq.clusters.clear();
+	QuerySeq.dualHist.clear();
+	QuerySeq.subMTX.clear();
+}
+
 
 // information loaders
-vector<Sequence> loadInfoFromInputFile(const char* infile){
-	FILE *inputFile = fopen(infile, "r");
-	vector<Sequence> querySeqs;
-	
-	int maxLine = 5000;
-	char line[maxLine];
-	char delim = '\t';
-	vector<string> elems;
-	string oldQuery = "";
-	string oldGene = "";
-		
-	while(fgets(line, maxLine, inputFile) != NULL){
-		elems.clear();
-		elems = split(string(line), delim);
-		string queryName = elems[12];
-		string geneName = elems[13];
-		IDnum geneGI = atoi(elems[14].c_str());
-		float identity = atof(elems[2].c_str());
-		float bitscore = atof(elems[11].c_str());
-		
-		if(identity < 40 || bitscore < 50){
-			continue;
+// gene_id of a GFF v2 attribute column, as infile_convert.pl extracts it:
+// s/(.+[ ,])?gene_id[ =]/gene_id_/ then s/[, ].*//;
+static string gff2GeneID(const string &attributes){
+	string id = attributes;
+	size_t match = string::npos;
+	for(size_t pos = attributes.find("gene_id"); pos != string::npos; pos = attributes.find("gene_id", pos + 1)){
+		if(pos + 7 < attributes.size() && (attributes[pos+7] == ' ' || attributes[pos+7] == '=')
+			&& pos >= 2 && (attributes[pos-1] == ' ' || attributes[pos-1] == ',')){
+			match = pos;
 		}
-		
-		if(oldQuery.compare(queryName) != 0){
-			oldQuery = queryName;
-			Sequence querySequence;
-			querySequence.seqName.assign(queryName);
-			querySeqs.push_back(querySequence);
-		}
-		
-		if(oldGene.compare(geneName) != 0){
-			oldGene = geneName;
-			Gene queryGene;
-			querySeqs.back().genes.push_back(queryGene);
+	}
+	if(match != string::npos){
+		id = "gene_id_" + attributes.substr(match + 8);
+	}else{
+		for(size_t pos = attributes.find("gene_id"); pos != string::npos; pos = attributes.find("gene_id", pos + 1)){
+			if(pos + 7 < attributes.size() && (attributes[pos+7] == ' ' || attributes[pos+7] == '=')){
+				id = attributes.substr(0, pos) + "gene_id_" + attributes.substr(pos + 8);
+				break;
+			}
 		}
-		
-		// this is the part we need to fix
-		// if the new entry's bitscore is within the range of > 0.9*current_min_score
-		// then we add this new entry, also clean up the gene registry if the new entry's
-		// bitscore is higher than the current_min_score;
-		
-		if (bitscore >= 0.9 * querySeqs.back().genes.back().min_current_bitscore()){
-			querySeqs.back().genes.back().gis.push_back(geneGI);
-			querySeqs.back().genes.back().identity.push_back(identity);
-			querySeqs.back().genes.back().bitscore.push_back(bitscore);
-			querySeqs.back().genes.back().organize_entries();
+	}
+	size_t end = id.find_first_of(", ");
+	return (end == string::npos)?id:id.substr(0, end);
+}
+
+// the ID= (any case) value of a GFF v3 attribute column, "" if none;
+static string gff3GeneID(const string &attributes){
+	for(size_t pos = 0; pos + 3 <= attributes.size(); pos++){
+		if(strncasecmp(attributes.c_str() + pos, "id=", 3) == 0){
+			size_t end = attributes.find(';', pos + 3);
+			return attributes.substr(pos + 3, (end == string::npos)?string::npos:end - pos - 3);
 		}
 	}
+	return "";
+}
+
+InputFormat *loadGenePredictions(const char* geneFile, const char* format, double minAlignedFraction){
+	InputFormat *inputFormat = new InputFormat;
+	inputFormat->mapGenes = (strcmp(format, "no") != 0);
+	inputFormat->minAlignedFraction = minAlignedFraction;
+	if(!inputFormat->mapGenes){
+		return inputFormat;
+	}
+	if(strcmp(format, "gff2") != 0 && strcmp(format, "gff3") != 0 && strcmp(format, "tab") != 0){
+		cerr << "Unsupported gene prediction format: " << format << endl;
+		exit(EXIT_FAILURE);
+	}
 	
-	fclose(inputFile);
-	
-	/*
-	for(vector<Sequence>::iterator it = querySeqs.begin(); it != querySeqs.end(); ++it){
-		cout << it->seqName << endl;
-		int gene_index = 0;
-		for(vector<Gene>::iterator git = it->genes.begin(); git != it->genes.end(); ++git){
-			gene_index++;
-			cout << "Gene " << gene_index << endl;
-			for(vector<IDnum>::iterator idit = git->gis.begin(); idit != git->gis.end(); ++idit){
-				cout << *idit << ' ';
+	LineReader *reader = openLineReader(geneFile);
+	const char *line;
+	size_t length;
+	long lineNum = 0;
+	while(readLine(reader, &line, &length)){
+		lineNum++;
+		string text(line, length);
+		if(text.empty() || text[0] == '#' || text.find_first_not_of(" \t\r\f\v") == string::npos){
+			continue;
+		}
+		vector<string> elems = split(text, '\t');
+		GeneLocus locus;
+		string id;
+		if(strcmp(format, "tab") == 0){
+			if(elems.size() < 3){
+				cerr << "Cannot parse line " << lineNum << " of " << geneFile << ": " << text << endl;
+				exit(EXIT_FAILURE);
 			}
-			cout << endl;
-			for(vector<float>::iterator idit = git->bitscore.begin(); idit != git->bitscore.end(); ++idit){
-				cout << *idit << ' ';
+			if(atof(elems[1].c_str()) == 0){
+				cerr << elems[0] << ": Length zero." << endl;
+				exit(EXIT_FAILURE);
 			}
-			cout << "Minimum bitscore: " << git->min_current_bitscore() << endl;
+			id = elems[0];
+			locus.contig = elems[2];
+			locus.length = atof(elems[1].c_str()) / 3;
+		}else{
+			if(elems.size() < 9){
+				cerr << "Cannot parse line " << lineNum << " of " << geneFile << ": " << text << endl;
+				exit(EXIT_FAILURE);
+			}
+			if(strcmp(format, "gff2") == 0){
+				id = gff2GeneID(elems[8]);
+			}else if((id = gff3GeneID(elems[8])).empty()){
+				cerr << "Cannot parse line " << lineNum << " of " << geneFile << ": " << text << endl;
+				exit(EXIT_FAILURE);
+			}
+			locus.contig = elems[0].substr(0, elems[0].find(' '));
+			locus.length = (1 + atof(elems[4].c_str()) - atof(elems[3].c_str())) / 3;
 		}
+		inputFormat->genes[id] = locus;
 	}
-	*/
+	closeLineReader(reader);
+	return inputFormat;
+}
+
+void destroyInputFormat(InputFormat *format){
+	delete format;
+}
 
-	return querySeqs;
+void initHitFilter(HitFilter &filter){
+	filter.maxHitsPerGene = 0;
+	filter.minIdentity = MIN_IDENTITY;
+	filter.minBitscore = MIN_BITSCORE;
+	filter.scoreDropThr = SCORE_DROP_THR;
+	filter.includeTaxa.clear();
+	filter.excludeTaxa.clear();
+	filter.tTree = NULL;
+	filter.image = NULL;
+	filter.gi2taxon = NULL;
 }
 
+void initScoreWeights(ScoreWeights &weights){
+	weights.dualHist[0] = W10;
+	weights.dualHist[1] = W11;
+	weights.dualHist[2] = W12;
+	weights.subMTX[0] = W20;
+	weights.subMTX[1] = W21;
+	weights.subMTX[2] = W22;
+}
 
-// load gi->taxonID mapping information
-void loadGI2TaxonLibFromFile(const char* gi2taxonFile, vector<Sequence> &QuerySeq){
-	map<IDnum, IDnum> giHits;
-	map<IDnum, IDnum>::iterator it;
+void loadScoringParams(const char* paramFile, ScoreWeights &weights, HitFilter &filter){
+	struct scoringParam_st{
+		const char *name;
+		float *weight;      // one of the two is set
+		double *value;
+	} params[9] = {
+		{"W10", &weights.dualHist[0], NULL}, {"W11", &weights.dualHist[1], NULL}, {"W12", &weights.dualHist[2], NULL},
+		{"W20", &weights.subMTX[0], NULL}, {"W21", &weights.subMTX[1], NULL}, {"W22", &weights.subMTX[2], NULL},
+		{"SCORE_DROP_THR", NULL, &filter.scoreDropThr},
+		{"MIN_IDENTITY", NULL, &filter.minIdentity},
+		{"MIN_BITSCORE", NULL, &filter.minBitscore}
+	};
 	
-	for(unsigned int index = 0; index < QuerySeq.size(); index++){
-		for(unsigned int i = 0; i < QuerySeq[index].genes.size(); i++){
-			for(unsigned int j = 0; j < QuerySeq[index].genes[i].gis.size(); j++){
-				it = giHits.begin();
-				giHits.insert(it, pair<IDnum, IDnum> (QuerySeq[index].genes[i].gis[j], 0));				
-			}
+	LineReader *reader = openLineReader(paramFile);
+	const char *line;
+	size_t length;
+	long lineNum = 0;
+	while(readLine(reader, &line, &length)){
+		lineNum++;
+		string text(line, length);
+		text = text.substr(0, text.find('#'));
+		stringstream fields(text);
+		string name, value, rest;
+		if(!(fields >> name)){
+			continue;
+		}
+		char *end = NULL;
+		double number = 0;
+		if(fields >> value){
+			number = strtod(value.c_str(), &end);
+		}
+		if(end == NULL || *end != '\0' || end == value.c_str() || (fields >> rest)){
+			cerr << "Cannot parse line " << lineNum << " of " << paramFile << ": " << text << endl;
+			exit(EXIT_FAILURE);
+		}
+		int index = 0;
+		while(index < 9 && name.compare(params[index].name) != 0){
+			index++;
+		}
+		if(index == 9){
+			cerr << "Unknown scoring parameter " << name << " at line " << lineNum << " of " << paramFile << endl;
+			exit(EXIT_FAILURE);
+		}
+		if(params[index].weight != NULL){
+			*params[index].weight = number;
+		}else{
+			*params[index].value = number;
 		}
 	}
+	closeLineReader(reader);
+}
+
+// hit selection within a gene
+
+// the bitscore drop comparison of two adjacent hits, as gene_st::max_gap() did it;
+static inline bool isBigGap(const HitSelector &hits, float a, float b){
+	float min = (a < b)?a:b;
+	float max = (a > b)?a:b;
+	float g = (max - min) / max;
+	return g > hits.scoreDropThr;
+}
+
+static inline bool heapLess(const HitSelector &hits, int a, int b){
+	return hits.bitscore[a] < hits.bitscore[b] || (hits.bitscore[a] == hits.bitscore[b] && hits.order[a] < hits.order[b]);
+}
+
+static void heapSwap(HitSelector &hits, int i, int j){
+	int a = hits.heap[i];
+	hits.heap[i] = hits.heap[j];
+	hits.heap[j] = a;
+	hits.heapPos[hits.heap[i]] = i;
+	hits.heapPos[hits.heap[j]] = j;
+}
+
+static void heapUp(HitSelector &hits, int i){
+	while(i > 0 && heapLess(hits, hits.heap[i], hits.heap[(i-1)/2])){
+		heapSwap(hits, i, (i-1)/2);
+		i = (i-1)/2;
+	}
+}
+
+static void heapDown(HitSelector &hits, int i){
+	int size = hits.heap.size();
+	while(true){
+		int smallest = i;
+		if(2*i + 1 < size && heapLess(hits, hits.heap[2*i + 1], hits.heap[smallest])){
+			smallest = 2*i + 1;
+		}
+		if(2*i + 2 < size && heapLess(hits, hits.heap[2*i + 2], hits.heap[smallest])){
+			smallest = 2*i + 2;
+		}
+		if(smallest == i){
+			return;
+		}
+		heapSwap(hits, i, smallest);
+		i = smallest;
+	}
+}
+
+static void initHitSelector(HitSelector &hits, unsigned int capacity, double scoreDropThr){
+	hits.capacity = capacity;
+	hits.scoreDropThr = scoreDropThr;
+	hits.head = -1;
+	hits.tail = -1;
+	hits.numBigGaps = 0;
+	hits.numInputs = 0;
+}
+
+static void clearHitSelector(HitSelector &hits){
+	hits.gis.clear();
+	hits.taxonIDs.clear();
+	hits.identity.clear();
+	hits.bitscore.clear();
+	hits.order.clear();
+	hits.prev.clear();
+	hits.next.clear();
+	hits.heapPos.clear();
+	hits.heap.clear();
+	hits.freeSlots.clear();
+	initHitSelector(hits, hits.capacity, hits.scoreDropThr);
+}
+
+static void removeHit(HitSelector &hits, int slot){
+	int before = hits.prev[slot];
+	int after = hits.next[slot];
+	if(before >= 0 && isBigGap(hits, hits.bitscore[before], hits.bitscore[slot])){
+		hits.numBigGaps--;
+	}
+	if(after >= 0 && isBigGap(hits, hits.bitscore[slot], hits.bitscore[after])){
+		hits.numBigGaps--;
+	}
+	if(before >= 0 && after >= 0 && isBigGap(hits, hits.bitscore[before], hits.bitscore[after])){
+		hits.numBigGaps++;
+	}
+	if(before >= 0){
+		hits.next[before] = after;
+	}else{
+		hits.head = after;
+	}
+	if(after >= 0){
+		hits.prev[after] = before;
+	}else{
+		hits.tail = before;
+	}
 	
-	FILE *libFile = fopen(gi2taxonFile, "r");
-	
-	int maxLine = 1000;
-	char line[maxLine];
-	IDnum GI, taxonID;
+	int pos = hits.heapPos[slot];
+	int last = hits.heap.size() - 1;
+	if(pos != last){
+		heapSwap(hits, pos, last);
+	}
+	hits.heap.pop_back();
+	if(pos != last){
+		int moved = hits.heap[pos];
+		heapUp(hits, pos);
+		heapDown(hits, hits.heapPos[moved]);
+	}
+	hits.freeSlots.push_back(slot);
+}
+
+static void appendHit(HitSelector &hits, RefID GI, IDnum taxonID, float identity, float bitscore){
+	int slot;
+	if(hits.freeSlots.empty()){
+		slot = hits.gis.size();
+		hits.gis.push_back(GI);
+		hits.taxonIDs.push_back(taxonID);
+		hits.identity.push_back(identity);
+		hits.bitscore.push_back(bitscore);
+		hits.order.push_back(hits.numInputs);
+		hits.prev.push_back(hits.tail);
+		hits.next.push_back(-1);
+		hits.heapPos.push_back(hits.heap.size());
+	}else{
+		slot = hits.freeSlots.back();
+		hits.freeSlots.pop_back();
+		hits.gis[slot] = GI;
+		hits.taxonIDs[slot] = taxonID;
+		hits.identity[slot] = identity;
+		hits.bitscore[slot] = bitscore;
+		hits.order[slot] = hits.numInputs;
+		hits.prev[slot] = hits.tail;
+		hits.next[slot] = -1;
+		hits.heapPos[slot] = hits.heap.size();
+	}
+	hits.numInputs++;
 	
-	while(fgets(line, maxLine, libFile) != NULL){
-		stringstream lineStream;
-		lineStream << line;
-		lineStream >> GI >> taxonID;
-		if(giHits.count(GI) != 0){
-			giHits.find(GI)->second = taxonID;
+	if(hits.tail >= 0){
+		hits.next[hits.tail] = slot;
+		if(isBigGap(hits, hits.bitscore[hits.tail], bitscore)){
+			hits.numBigGaps++;
 		}
+	}else{
+		hits.head = slot;
+	}
+	hits.tail = slot;
+	hits.heap.push_back(slot);
+	heapUp(hits, hits.heap.size() - 1);
+}
+
+// whether selectHit() drops a hit of this bitscore as it comes, leaving the
+// selection as it is;
+static bool hitRejected(const HitSelector &hits, float bitscore){
+	// the sentinels of the former per-gene min_current_bitscore() and remove_min();
+	float lowest = 0;
+	if(!hits.heap.empty()){
+		lowest = hits.bitscore[hits.heap[0]];
+		if(lowest > 100000){
+			lowest = 100000;
+		}
+	}
+	if(bitscore < 0.9 * lowest){
+		return true;
+	}
+	return hits.capacity > 0 && hits.heap.size() >= hits.capacity && bitscore <= hits.bitscore[hits.heap[0]];
+}
+
+// a hit of the current gene, in input order; a hit within 0.9 of the lowest
+// kept bitscore is kept, then, if any two hits adjacent in input order are
+// more than scoreDropThr apart, the lowest one is dropped (the first in
+// input order of equal ones); a full selector only takes hits better than
+// its lowest one, which is dropped for them;
+static void selectHit(HitSelector &hits, RefID GI, IDnum taxonID, float identity, float bitscore){
+	if(hitRejected(hits, bitscore)){
+		return;
+	}
+	if(hits.capacity > 0 && hits.heap.size() >= hits.capacity){
+		removeHit(hits, hits.heap[0]);
 	}
-	fclose(libFile);
 	
-	for(unsigned int index = 0; index < QuerySeq.size(); index++){
-		for(unsigned int i = 0; i < QuerySeq[index].genes.size(); i++){
-			for(unsigned int j = 0; j < QuerySeq[index].genes[i].gis.size(); j++){
-				IDnum GI = QuerySeq[index].genes[i].gis[j];
-				if(GI > 0){
-					QuerySeq[index].genes[i].taxonIDs.push_back(giHits.find(GI)->second);
-				}else{
-					QuerySeq[index].genes[i].taxonIDs.push_back(0);
-				}
-			}
+	appendHit(hits, GI, taxonID, identity, bitscore);
+	if(hits.heap.size() >= 2 && hits.numBigGaps > 0){
+		removeHit(hits, (hits.bitscore[hits.heap[0]] < 10000)?hits.heap[0]:hits.head);
+	}
+}
+
+// append the kept hits, in input order, as a gene of the last query sequence,
+// with their taxa if they were looked up;
+static void flushHits(HitSelector &hits, QueryBatch &QuerySeq, bool withTaxa){
+	Sequence &seq = QuerySeq.seqs.back();
+	QuerySeq.geneStarts.push_back(QuerySeq.gis.size());
+	seq.numGenes++;
+	for(int slot = hits.head; slot >= 0; slot = hits.next[slot]){
+		QuerySeq.gis.push_back(hits.gis[slot]);
+		if(withTaxa){
+			QuerySeq.taxonIDs.push_back(hits.taxonIDs[slot]);
 		}
+		QuerySeq.identity.push_back(hits.identity[slot]);
+		QuerySeq.bitscore.push_back(hits.bitscore[slot]);
+		seq.numHits++;
 	}
+	clearHitSelector(hits);
 }
 
-float getHistPara(string dh, float identity){
-	char delim = '\t';
-	vector<string> elems = split(dh, delim);
-	unsigned int index = 1000 - int(identity*10);
-	try{
-		return atof(elems[index].c_str());
-	}catch(exception& e){
-		return	1.0;
+QueryReader *openQueryReader(const char* infile, InputFormat *format, HitFilter *filter, string *error){
+	LineReader *lines = openLineReader(infile, error);
+	if(lines == NULL){
+		return NULL;
+	}
+	QueryReader *reader = new QueryReader;
+	reader->lines = lines;
+	reader->format = format;
+	if(filter != NULL){
+		reader->filter = *filter;
+	}else{
+		initHitFilter(reader->filter);
+	}
+	initHitSelector(reader->hits, reader->filter.maxHitsPerGene, reader->filter.scoreDropThr);
+	reader->filterTaxa = !reader->filter.includeTaxa.empty() || !reader->filter.excludeTaxa.empty();
+	reader->gi2taxonIndex = NULL;
+	if(reader->filterTaxa && reader->filter.image != NULL){
+		reader->gi2taxonIndex = new DBPairIndex;
+		dbOpenPairIndex(reader->filter.image, DB_SECT_GI2TAXON, DB_SECT_GI2TAXON_VALUES, DB_SECT_GI2TAXON_INDEX, reader->gi2taxonIndex);
 	}
+	reader->oldQuery = "";
+	reader->oldGene = "";
+	reader->pending = false;
+	return reader;
 }
 
-// load gi->clstr mapping information
-void loadGI2ClstrLibFromFile(const char* gi2clstrFile, vector<Sequence> &QuerySeq){
-	map<IDnum, IDnum> gi2clstr;
-	map<IDnum, IDnum>::iterator it;
-	
-	map<IDnum, vector<string> > dualHist;
-	map<IDnum, vector<string> >::iterator dhit;
-	
-	map<IDnum, vector<float> > subMTX;
-	map<IDnum, vector<float> >::iterator smit;
-	
-	gi2clstr.clear();
-	dualHist.clear();
-	subMTX.clear();
-
-	for(unsigned int index = 0; index < QuerySeq.size(); index++){
-		for(unsigned int i = 0; i < QuerySeq[index].genes.size(); i++){
-			for(unsigned int j = 0; j < QuerySeq[index].genes[i].gis.size(); j++){
-				it = gi2clstr.begin();
-				
-				gi2clstr.insert(it, pair<IDnum, IDnum> (QuerySeq[index].genes[i].gis[j], 0));	
-			}			
-		}
-	}
-	
-	FILE *libFile = fopen(gi2clstrFile, "r");
-	
-	int maxLine = 10000;
-	char line[maxLine];
-	char delim = '\t';
-	while(fgets(line, maxLine, libFile) != NULL){
-		// first line, the clstr ID
-		stringstream ss;
-		ss << line;
-		IDnum clstrID;
-		int clstrSize;
-		ss >> clstrID >> clstrSize;
-		int numLines = clstrSize/10;
-		if(clstrSize%10 != 0){
-			numLines++;
+const string &queryReaderError(QueryReader *reader){
+	return lineReaderError(reader->lines);
+}
+
+void closeQueryReader(QueryReader *reader){
+	closeLineReader(reader->lines);
+	delete reader->gi2taxonIndex;
+	delete reader;
+}
+
+// the GI of a subject ID like gi|49185611|ref|YP_028863.1|, or a subject ID
+// that is a number itself (a reference database renumbered past the retired
+// GIs); 0 if none;
+static RefID subjectGI(const TextField &subject){
+	long GI;
+	if(parseIntField(subject.begin, subject.end, &GI) == subject.end){
+		return GI;
+	}
+	for(const char *p = subject.begin; p + 3 < subject.end; p++){
+		if(p[0] != 'g' || p[1] != 'i' || p[2] != '|'){
+			continue;
 		}
-		
-		//lines with all members of the gene cluster
-		bool hasThisClstr = false;
-		for(int lineNum = 0; lineNum < numLines; lineNum++){
-			fgets(line, maxLine, libFile);
-			vector<string> elems = split(string(line), delim);
-			for(unsigned int index = 0; index < elems.size(); index++){
-				IDnum GI = atoi(elems[index].c_str());
-				if(gi2clstr.count(GI) != 0){
-					hasThisClstr = true;
-					gi2clstr.find(GI)->second = clstrID;
-				}
-			}
+		const char *q = p + 3;
+		GI = 0;
+		while(q < subject.end && *q >= '0' && *q <= '9'){
+			GI = GI * 10 + (*q - '0');
+			q++;
 		}
-		
-		// handle line 3-6, phylum/genus/species parameters of this cluster
-		if(hasThisClstr){
-			dhit = dualHist.begin();
-			smit = subMTX.begin();
-			vector<string> dh;
-			dh.clear();
-			vector<float> sm;
-			sm.clear();
-			
-			for(int i = 0; i < 3; i++){
-				fgets(line, maxLine, libFile);
-				dh.push_back(string(line));
-			}
-			dualHist.insert(dhit, pair<IDnum, vector<string> > (clstrID, dh));
-			
-			fgets(line, maxLine, libFile);
-			vector<string> elems = split(string(line), delim);
-			for(unsigned int j = 0; j < elems.size(); j++){
-				try{
-					float r = atof(elems[j].c_str());
-					sm.push_back(r);
-				}catch(exception& e){
-					float r = -1.0;
-					sm.push_back(r);
-				}
-			}
-			subMTX.insert(smit, pair<IDnum, vector<float> > (clstrID, sm));
-			
-		}else{
-			for(int i = 0; i < 4; i++){
-				fgets(line, maxLine, libFile);
-			}
+		if(q > p + 3 && q < subject.end && *q == '|'){
+			return GI;
 		}
-		
 	}
-	fclose(libFile);
-	
-	// load information onto QuerySeq
-	
-	try{
-		for(unsigned int index = 0; index < QuerySeq.size(); index++){
-			for(unsigned int i = 0; i < QuerySeq[index].genes.size(); i++){
-				for(unsigned int j = 0; j < QuerySeq[index].genes[i].gis.size(); j++){
-					IDnum GI = QuerySeq[index].genes[i].gis[j];
-					IDnum clstrID = gi2clstr.find(GI)->second;
-				
-					if(clstrID == 0){   // in case the GI is not in lib;
-						QuerySeq[index].genes[i].clusters.push_back(0);
-						QuerySeq[index].genes[i].dualHist.push_back(-1);
-						QuerySeq[index].genes[i].dualHist.push_back(-1);
-						QuerySeq[index].genes[i].dualHist.push_back(-1);
-						QuerySeq[index].genes[i].subMTX.push_back(-1);
-						QuerySeq[index].genes[i].subMTX.push_back(-1);
-						QuerySeq[index].genes[i].subMTX.push_back(-1);
-						continue;
-					}
-				
-					// regular case;
-					vector<string> dh = dualHist.find(clstrID)->second;
-					vector<float> sub = subMTX.find(clstrID)->second;
-					
-					float identity = QuerySeq[index].genes[i].identity[j];
-					float phylumHist = getHistPara(dh[0], identity);
-					float genusHist = getHistPara(dh[1], identity);
-					float speciesHist = getHistPara(dh[2], identity);
-					// load the parameters
-					QuerySeq[index].genes[i].clusters.push_back(clstrID);
-					QuerySeq[index].genes[i].dualHist.push_back(phylumHist);
-					QuerySeq[index].genes[i].dualHist.push_back(genusHist);
-					QuerySeq[index].genes[i].dualHist.push_back(speciesHist);
-					
-					for(int k = 0; k < 3; k++){
-						QuerySeq[index].genes[i].subMTX.push_back(sub[k]);
-					}
-					
-				}			
-			}
+	return 0;
+}
+
+// next hit of a raw tabular search output line that passes the alignment
+// fraction filter; the query of the hit is the contig of its gene;
+static bool readTabularLine(QueryReader *reader, const char *line, size_t length){
+	TextField fields[12];
+	if(splitFields(line, line + length, '\t', fields, 12) < 12){
+		return false;
+	}
+	reader->geneName.assign(fields[0].begin, fields[0].end - fields[0].begin);
+	if(reader->format->mapGenes){
+		unordered_map<string, GeneLocus>::const_iterator it = reader->format->genes.find(reader->geneName);
+		if(it == reader->format->genes.end()){
+			cerr << "Cannot find contig for gene " << reader->geneName << endl;
+			exit(EXIT_FAILURE);
+		}
+		double alignedLength = parseFloatField(fields[3].begin, fields[3].end);
+		if(alignedLength < reader->format->minAlignedFraction * it->second.length){
+			return false;
 		}
-	}catch(exception& e){
-		cout << "get an error: " << e.what() << endl;
+		reader->queryName.assign(it->second.contig);
+	}else{
+		reader->queryName.assign(reader->geneName);
 	}
-	//end of function
+	
+	reader->geneGI = subjectGI(fields[1]);
+	if(reader->geneGI == 0){
+		cerr << "Cannot parse GI in " << string(fields[1].begin, fields[1].end - fields[1].begin) << endl;
+		exit(EXIT_FAILURE);
+	}
+	reader->identity = parseFloatField(fields[2].begin, fields[2].end);
+	reader->bitscore = parseFloatField(fields[11].begin, fields[11].end);
+	return reader->identity >= reader->filter.minIdentity && reader->bitscore >= reader->filter.minBitscore;
 }
 
-// add pertaining ranks taxonID to taxonPath of query sequences;
-void addToSeqTaxonPaths(vector<IDRank> tPath, map<IDnum, PathNode*> &seqTaxonForest){
-	PathNode *rootNode;
-	map<IDnum, PathNode*>::iterator it;
+// whether the taxon of the hit just read passes the include and exclude
+// lists of the filter; hits of unknown taxa are under none of them. Most
+// hits of a gene are dropped by the selection as they come, which does not
+// depend on their taxa, so those are let through without a lookup;
+static bool hitTaxonKept(QueryReader *reader){
+	reader->taxonID = 0;
+	if(!reader->filterTaxa){
+		return true;
+	}
+	if(hitRejected(reader->hits, reader->bitscore) && reader->geneName.compare(reader->oldGene) == 0
+		&& reader->queryName.compare(reader->oldQuery) == 0){
+		return true;
+	}
+	const HitFilter &filter = reader->filter;
+	IDnum &taxonID = reader->taxonID;
+	if(reader->gi2taxonIndex != NULL){
+		dbLookupPairIndex(reader->gi2taxonIndex, reader->geneGI, &taxonID);
+	}else if(filter.gi2taxon != NULL){
+		map<RefID, IDnum>::const_iterator it = filter.gi2taxon->find(reader->geneGI);
+		if(it != filter.gi2taxon->end()){
+			taxonID = it->second;
+		}
+	}
 	
-	// if no root exists yet, then add a root to the forest;
-	if(seqTaxonForest.size() == 0){
-		rootNode = newPathNode();
-		rootNode->category = 0;
-		it = seqTaxonForest.begin();
-		seqTaxonForest.insert(it, pair<IDnum, PathNode*> (0, rootNode));
-	}else{
-		rootNode = seqTaxonForest.find(0)->second;
+	if(!filter.includeTaxa.empty()){
+		bool included = false;
+		for(unsigned int i = 0; i < filter.includeTaxa.size() && !included; i++){
+			included = taxonUnder(filter.tTree, taxonID, filter.includeTaxa[i]);
+		}
+		if(!included){
+			return false;
+		}
 	}
-	// add taxonPath to the forest;
-	PathNode *phylumNode = newPathNode();
-	PathNode *genusNode = newPathNode();
-	PathNode *speciesNode = newPathNode();
+	for(unsigned int i = 0; i < filter.excludeTaxa.size(); i++){
+		if(taxonUnder(filter.tTree, taxonID, filter.excludeTaxa[i])){
+			return false;
+		}
+	}
+	return true;
+}
+
+// next input line that passes the identity, bitscore and taxon filters; the
+// fields are parsed in place, the names copied into strings that keep their
+// capacity;
+static bool readQueryLine(QueryReader *reader){
+	const char *line;
+	size_t length;
+	TextField fields[15];
 	
-	for(unsigned int index = 0; index < tPath.size(); index++){
-		IDnum taxonID = tPath[index].taxonID;
-		string rank = tPath[index].rank;
+	while(readLine(reader->lines, &line, &length)){
+		if(reader->format != NULL){
+			if(readTabularLine(reader, line, length) && hitTaxonKept(reader)){
+				return true;
+			}
+			continue;
+		}
+		if(splitFields(line, line + length, '\t', fields, 15) < 15){
+			continue;
+		}
+		reader->identity = parseFloatField(fields[2].begin, fields[2].end);
+		reader->bitscore = parseFloatField(fields[11].begin, fields[11].end);
 		
-		// discard the nodes that are not phylum/genus/species ranks;
-		if((rank.compare("species") != 0) and (rank.compare("genus") != 0) and (rank.compare("phylum") !=0)){
+		if(reader->identity < reader->filter.minIdentity || reader->bitscore < reader->filter.minBitscore){
 			continue;
 		}
+		long GI;
+		reader->queryName.assign(fields[12].begin, fields[12].end - fields[12].begin);
+		reader->geneName.assign(fields[13].begin, fields[13].end - fields[13].begin);
+		reader->geneGI = (parseIntField(fields[14].begin, fields[14].end, &GI) != NULL)?GI:0;
+		if(!hitTaxonKept(reader)){
+			continue;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool readQuerySequence(QueryReader *reader, QueryBatch &QuerySeq){
+	bool started = false;
+	bool geneStarted = false;
 	
-		// either load the node onto the forest or point to pre-existing node;
-		if(rank.compare("species") == 0){
-			if(seqTaxonForest.count(taxonID) == 0){
-				it = seqTaxonForest.begin();
-				speciesNode->taxonID = taxonID;
-				speciesNode->category = 3;
-				speciesNode->likelihood = 0.0;
-				seqTaxonForest.insert(it, pair<IDnum, PathNode*> (taxonID, speciesNode));
-			}else{
-				speciesNode = seqTaxonForest.find(taxonID)->second;
-			}
-		}else if(rank.compare("genus") == 0){
-			if(seqTaxonForest.count(taxonID) == 0){
-				it = seqTaxonForest.begin();
-				genusNode->taxonID = taxonID;
-				genusNode->category = 2;
-				genusNode->likelihood = 0.0;
-				seqTaxonForest.insert(it, pair<IDnum, PathNode*> (taxonID, genusNode));
-			}else{
-				genusNode = seqTaxonForest.find(taxonID)->second;
+	// a query sequence ends where the query name changes;
+	while(reader->pending || readQueryLine(reader)){
+		if(reader->oldQuery.compare(reader->queryName) != 0){
+			if(started){
+				flushHits(reader->hits, QuerySeq, reader->filterTaxa);
+				reader->pending = true;
+				return true;
 			}
-		}else if(rank.compare("phylum") == 0){
-			if(seqTaxonForest.count(taxonID) == 0){
-				it = seqTaxonForest.begin();
-				phylumNode->taxonID = taxonID;
-				phylumNode->category = 1;
-				phylumNode->likelihood = 0.0;
-				seqTaxonForest.insert(it, pair<IDnum, PathNode*> (taxonID, phylumNode));
-			}else{
-				phylumNode = seqTaxonForest.find(taxonID)->second;
+			reader->oldQuery = reader->queryName;
+		}
+		if(!started){
+			QuerySeq.seqs.push_back(Sequence());
+			Sequence &seq = QuerySeq.seqs.back();
+			seq.seqName.assign(reader->queryName);
+			seq.firstGene = QuerySeq.geneStarts.size();
+			seq.numGenes = 0;
+			seq.firstHit = QuerySeq.gis.size();
+			seq.numHits = 0;
+		}
+		reader->pending = false;
+		started = true;
+		
+		if(reader->oldGene.compare(reader->geneName) != 0 || !geneStarted){
+			if(geneStarted){
+				flushHits(reader->hits, QuerySeq, reader->filterTaxa);
 			}
+			reader->oldGene = reader->geneName;
+			geneStarted = true;
 		}
-	} // end of for loop;
-	
-	// connect the nodes, hook to rootNode;
-	if(phylumNode->prevNode == NULL){
-		phylumNode->prevNode = rootNode;
+		selectHit(reader->hits, reader->geneGI, reader->taxonID, reader->identity, reader->bitscore);
 	}
-	if(genusNode->prevNode == NULL){
-		genusNode->prevNode = phylumNode;
+	if(started){
+		flushHits(reader->hits, QuerySeq, reader->filterTaxa);
 	}
-	if(speciesNode->prevNode == NULL){
-		speciesNode->prevNode = genusNode;
+	return started;
+}
+
+unsigned int readQuerySequences(QueryReader *reader, QueryBatch &QuerySeq, unsigned int maxSeqs){
+	unsigned int numRead = 0;
+	while(numRead < maxSeqs && readQuerySequence(reader, QuerySeq)){
+		numRead++;
 	}
-	//end of function;
+	return numRead;
+}
+
+void loadInfoFromInputFile(const char* infile, QueryBatch &QuerySeq, InputFormat *format, HitFilter *filter){
+	QueryReader *reader = openQueryReader(infile, format, filter);
+	readQuerySequences(reader, QuerySeq, UINT_MAX);
+	closeQueryReader(reader);
 }
 
-vector<IDnum> getTaxonIDAtThreeRanks(TaxonTree *tTree, IDnum leafTaxonID){
-	vector<IDnum> taxonIDs;
-	vector<IDRank> idr = taxonomyPathIDRank(tTree, leafTaxonID);
-	IDnum phylum=0, genus=0, species=0;
-	
-	for(unsigned int index = 0; index < idr.size(); index++){
-		IDnum taxonID = idr[index].taxonID;
-		string rank = idr[index].rank;
-		if(rank.compare("phylum") == 0){
-			phylum = taxonID;
-		}else if(rank.compare("genus") == 0){
-			genus = taxonID;
-		}else if(rank.compare("species") == 0){
-			species = taxonID;
+
+void collectInputGIs(const char* infile, InputFormat *format, HitFilter *filter, map<RefID, IDnum> &giHits){
+	HitFilter lineFilter;
+	if(filter != NULL){
+		lineFilter = *filter;
+	}else{
+		initHitFilter(lineFilter);
+	}
+	lineFilter.includeTaxa.clear();
+	lineFilter.excludeTaxa.clear();
+	QueryReader *reader = openQueryReader(infile, format, &lineFilter);
+	map<RefID, IDnum>::iterator it = giHits.begin();
+	while(readQueryLine(reader)){
+		it = giHits.insert(it, pair<RefID, IDnum> (reader->geneGI, 0));
+	}
+	closeQueryReader(reader);
+}
+
+// collect the distinct GIs of all hits in QuerySeq, each mapped to 0;
+void collectQueryGIs(QueryBatch &QuerySeq, map<RefID, IDnum> &giHits){
+	map<RefID, IDnum>::iterator it;
+	
+	for(unsigned int hit = 0; hit < QuerySeq.gis.size(); hit++){
+		it = giHits.begin();
+		giHits.insert(it, pair<RefID, IDnum> (QuerySeq.gis[hit], 0));
+	}
+}
+
+// load the resolved taxonIDs onto QuerySeq;
+static void assignTaxonIDs(QueryBatch &QuerySeq, map<RefID, IDnum> &giHits){
+	QuerySeq.taxonIDs.resize(QuerySeq.gis.size());
+	for(unsigned int hit = 0; hit < QuerySeq.gis.size(); hit++){
+		RefID GI = QuerySeq.gis[hit];
+		if(GI > 0){
+			QuerySeq.taxonIDs[hit] = giHits.find(GI)->second;
 		}else{
-			continue;
+			QuerySeq.taxonIDs[hit] = 0;
 		}
 	}
+}
+
+// state shared by the threads scanning geneTaxon.lib; each chunk collects the
+// (GI, taxonID) lines of query GIs in file order;
+struct gi2TaxonScan_st{
+	MappedFile *file;
+	vector<size_t> boundaries;
+	const map<RefID, IDnum> *giHits;
+	vector<vector<pair<RefID, IDnum> > > hits;
+};
+
+// lines of geneTaxon.lib: <GI> <taxonID>
+static void scanGI2TaxonChunk(int chunk, void *arg){
+	gi2TaxonScan_st *scan = (gi2TaxonScan_st *) arg;
+	const char *p = scan->file->data + scan->boundaries[chunk];
+	const char *end = scan->file->data + scan->boundaries[chunk+1];
+	vector<pair<RefID, IDnum> > &hits = scan->hits[chunk];
 	
-	taxonIDs.push_back(phylum);
-	taxonIDs.push_back(genus);
-	taxonIDs.push_back(species);
+	while(p < end){
+		const char *lineEnd = nextLine(p, end);
+		long GI, taxonID;
+		const char *q = parseIntField(p, lineEnd, &GI);
+		if(q != NULL && parseIntField(q, lineEnd, &taxonID) != NULL
+			&& scan->giHits->count(GI) != 0){
+			hits.push_back(pair<RefID, IDnum> (GI, taxonID));
+		}
+		p = lineEnd;
+	}
+}
+
+// resolve the GIs keyed in giHits, scanning the file on numThreads threads;
+static void resolveGI2TaxonFromFile(const char* gi2taxonFile, map<RefID, IDnum> &giHits, int numThreads){
+	gi2TaxonScan_st scan;
+	scan.file = mapTextFile(gi2taxonFile);
+	scan.boundaries = chunkBoundaries(scan.file, numThreads, MIN_SCAN_CHUNK, alignToLine);
+	scan.giHits = &giHits;
+	scan.hits.resize(scan.boundaries.size() - 1);
+	scanChunksInParallel(scan.hits.size(), scanGI2TaxonChunk, &scan);
+	unmapTextFile(scan.file);
 	
-	return taxonIDs;
+	// merge in file order, so the last line listing a GI wins;
+	for(unsigned int chunk = 0; chunk < scan.hits.size(); chunk++){
+		for(unsigned int index = 0; index < scan.hits[chunk].size(); index++){
+			giHits.find(scan.hits[chunk][index].first)->second = scan.hits[chunk][index].second;
+		}
+	}
 }
 
-// calculate the likelihood of taxonomy for query sequences;
-void likelihoodCal(TaxonTree *tTree, vector<Sequence> &QuerySeq){
+// load gi->taxonID mapping information;
+void loadGI2TaxonLibFromFile(const char* gi2taxonFile, QueryBatch &QuerySeq, int numThreads){
+	map<RefID, IDnum> giHits;
+	collectQueryGIs(QuerySeq, giHits);
+	resolveGI2TaxonFromFile(gi2taxonFile, giHits, numThreads);
+	assignTaxonIDs(QuerySeq, giHits);
+}
+
+// same as above, from the sorted GI index of a database image; the cost
+// depends on the number of distinct query GIs, not on the size of the library;
+void loadGI2TaxonLibFromImage(DBImage *image, QueryBatch &QuerySeq){
+	if(QuerySeq.taxonIDs.size() == QuerySeq.gis.size()){
+		// looked up by the reader already;
+		return;
+	}
+	map<RefID, IDnum> giHits;
+	map<RefID, IDnum>::iterator it;
+	collectQueryGIs(QuerySeq, giHits);
 	
-	for(unsigned int seqIndex = 0; seqIndex < QuerySeq.size(); seqIndex++){
-		// load all possible taxonomy paths onto query sequences;
-		for(vector<gene_st>::iterator git = QuerySeq[seqIndex].genes.begin();
-				git != QuerySeq[seqIndex].genes.end(); ++ git){
-			for(vector<IDnum>::iterator tit = git->taxonIDs.begin();
-				tit != git->taxonIDs.end(); ++ tit){
-				vector<IDRank> tPath = taxonomyPathIDRank(tTree, *tit);
-				addToSeqTaxonPaths(tPath, QuerySeq[seqIndex].seqTaxonForest);
-			}
-				
+	DBPairIndex index;
+	dbOpenPairIndex(image, DB_SECT_GI2TAXON, DB_SECT_GI2TAXON_VALUES, DB_SECT_GI2TAXON_INDEX, &index);
+	
+	for(it = giHits.begin(); it != giHits.end(); ++it){
+		dbLookupPairIndex(&index, it->first, &it->second);
+	}
+	
+	assignTaxonIDs(QuerySeq, giHits);
+}
+
+// parse a tab delimited line of numbers in place, one value per column;
+// empty columns are 0, as with atof() on the fields of split();
+void parseTabFloats(const char *line, const char *end, vector<float> &values){
+	values.clear();
+	const char *p = line;
+	while(true){
+		const char *fieldEnd = (const char *) memchr(p, '\t', end - p);
+		if(fieldEnd == NULL){
+			fieldEnd = end;
 		}
-		
-		// iterate through all matches and calculate the likelihoods;
-		// extract pointers to nodes at different ranks, put them in vectors;
-		vector<PathNode*> phylumNodes;
-		vector<PathNode*> genusNodes;
-		vector<PathNode*> speciesNodes;
-		map<IDnum, PathNode*>::iterator forestIt;
-		
-		for(forestIt = QuerySeq[seqIndex].seqTaxonForest.begin(); 
-			forestIt != QuerySeq[seqIndex].seqTaxonForest.end(); forestIt++){
-			PathNode* node = forestIt->second;
-			if(node->category == 0){
-				continue;
-			}else if(node->category == 1){
-				phylumNodes.push_back(node);
-			}else if(node->category == 2){
-				genusNodes.push_back(node);
-			}else if(node->category == 3){
-				speciesNodes.push_back(node);
-			}
+		values.push_back((p == fieldEnd)?0.0:parseFloatField(p, fieldEnd));
+		if(fieldEnd == end){
+			break;
 		}
+		p = fieldEnd + 1;
+	}
+}
+
+void parseTabFloats(const char *line, vector<float> &values){
+	parseTabFloats(line, line + strlen(line), values);
+}
+
+// dual histogram parameter of a hit, by its identity bin;
+float clusterPara_st::histPara(int rank, float identity) const{
+	unsigned int index = 1000 - int(identity*10);
+	if(index >= numBins){
+		return 1.0;
+	}
+	return dualHist[rank*numBins + index];
+}
+
+// load the parameters of the resolved clusters onto QuerySeq; hits of the same
+// cluster share its parsed parameters;
+static void assignClusterParas(QueryBatch &QuerySeq, map<RefID, IDnum> &gi2clstr,
+									map<IDnum, ClusterPara> &paras){
+	map<IDnum, ClusterPara>::iterator pit;
+	
+	QuerySeq.clusters.resize(QuerySeq.gis.size());
+	QuerySeq.dualHist.resize(3 * QuerySeq.gis.size());
+	QuerySeq.subMTX.resize(3 * QuerySeq.gis.size());
+	for(unsigned int hit = 0; hit < QuerySeq.gis.size(); hit++){
+		IDnum clstrID = gi2clstr.find(QuerySeq.gis[hit])->second;
 		
-		//iterate through matches, and add up the scores;
-		for(unsigned int geneIndex = 0; geneIndex < QuerySeq[seqIndex].genes.size(); geneIndex++){
-			for(unsigned int i = 0; i < QuerySeq[seqIndex].genes[geneIndex].gis.size(); i++){
-				
-				IDnum leafTaxonID = QuerySeq[seqIndex].genes[geneIndex].taxonIDs[i];
-				if(leafTaxonID == 0){
-					continue;
-				}
-				
-				vector<IDnum> taxonIDs = getTaxonIDAtThreeRanks(tTree, leafTaxonID);
-				
-				if(taxonIDs[0] == 0 or taxonIDs[1] == 0 or taxonIDs[2] == 0){
-					continue;
-				}
-				
-				
-				PathNode* phylumNode = QuerySeq[seqIndex].seqTaxonForest.find(taxonIDs[0])->second;
-				PathNode* genusNode = QuerySeq[seqIndex].seqTaxonForest.find(taxonIDs[1])->second;
-				PathNode* speciesNode = QuerySeq[seqIndex].seqTaxonForest.find(taxonIDs[2])->second;
-				
-				float dhPhylum, dhGenus, dhSpecies;
-				float smPhylum, smGenus, smSpecies;
-				
-				dhPhylum = QuerySeq[seqIndex].genes[geneIndex].dualHist[3*i];
-				smPhylum = QuerySeq[seqIndex].genes[geneIndex].subMTX[3*i];
-				
-				dhGenus = QuerySeq[seqIndex].genes[geneIndex].dualHist[3*i+1];
-				smGenus = QuerySeq[seqIndex].genes[geneIndex].subMTX[3*i+1];
-				
-				dhSpecies = QuerySeq[seqIndex].genes[geneIndex].dualHist[3*i+2];
-				smSpecies = QuerySeq[seqIndex].genes[geneIndex].subMTX[3*i+2];
-				
-				phylumNode->likelihood += W10*dhPhylum + W20*smPhylum;
-				genusNode->likelihood += W11*dhGenus + W21*smGenus;
-				speciesNode->likelihood += W12*dhSpecies + W22*smSpecies;
+		if(clstrID == 0 || (pit = paras.find(clstrID)) == paras.end()){   // in case the GI is not in lib;
+			QuerySeq.clusters[hit] = 0;
+			for(int k = 0; k < 3; k++){
+				QuerySeq.dualHist[3*hit + k] = -1;
+				QuerySeq.subMTX[3*hit + k] = -1;
 			}
+			continue;
 		}
 		
-		//iterate through nodes at different ranks in the taxonomy forest, and normalize scores into likelihoods;
-		// sum of scores
-		float phylumSum, genusSum, speciesSum;
-		phylumSum = 0;
-		genusSum = 0;
-		speciesSum = 0;
-		// phylum level;
-		for(unsigned int index = 0; index < phylumNodes.size(); index++){
-			phylumSum += phylumNodes[index]->likelihood;
+		// regular case;
+		const ClusterPara &para = pit->second;
+		QuerySeq.clusters[hit] = clstrID;
+		for(int k = 0; k < 3; k++){
+			QuerySeq.dualHist[3*hit + k] = para.histPara(k, QuerySeq.identity[hit]);
+			QuerySeq.subMTX[3*hit + k] = para.subMTX[k];
 		}
-		
-		for(unsigned int index = 0; index < phylumNodes.size(); index++){
-			if(phylumSum != 0){
-				phylumNodes[index]->likelihood /= phylumSum;
-			}else{
-				phylumNodes[index]->likelihood = 1.0;
+	}
+}
+
+// what one chunk of geneInfo.lib contributes, in file order: the (GI, clusterID)
+// memberships of query GIs and the parsed parameters of the clusters they hit
+// (three dual histograms, then the 3 subMTX values);
+struct clusterChunk_st{
+	vector<pair<RefID, IDnum> > hits;
+	vector<IDnum> paraIDs;
+	vector<vector<float> > paras;
+};
+
+struct gi2ClstrScan_st{
+	MappedFile *file;
+	vector<size_t> boundaries;
+	const map<RefID, IDnum> *gi2clstr;
+	vector<clusterChunk_st> chunks;
+};
+
+// header line of a geneInfo.lib record: <clusterID> <size>
+static bool parseClusterHeader(const char *p, const char *lineEnd, long *clstrID, long *clstrSize){
+	p = parseIntField(p, lineEnd, clstrID);
+	if(p == NULL || (p = parseIntField(p, lineEnd, clstrSize)) == NULL){
+		return false;
+	}
+	while(p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')){
+		p++;
+	}
+	return p == lineEnd && *clstrSize >= 0;
+}
+
+// a record is a header line, ceil(size/10) member lines of at most 10 GIs,
+// three histogram lines and a subMTX line; a member line of two GIs looks like
+// a header, but is then followed by a histogram line of far more than 10 fields;
+static bool isClusterStart(const char *data, size_t size, size_t pos){
+	const char *end = data + size;
+	const char *p = data + pos;
+	const char *lineEnd = nextLine(p, end);
+	long clstrID, clstrSize;
+	if(!parseClusterHeader(p, lineEnd, &clstrID, &clstrSize)){
+		return false;
+	}
+	long numLines = (clstrSize + 9) / 10;
+	for(long lineNum = 0; lineNum < numLines; lineNum++){
+		p = lineEnd;
+		if(p == end){
+			return false;
+		}
+		lineEnd = nextLine(p, end);
+		int numFields = 1;
+		for(const char *q = p; q < lineEnd; q++){
+			if(*q == '\t'){
+				numFields++;
+			}else if((*q < '0' || *q > '9') && *q != '\n' && *q != '\r' && *q != '-'){
+				return false;
 			}
 		}
-		
-		// genus level;
-		for(unsigned int index = 0; index < genusNodes.size(); index++){
-			genusSum += genusNodes[index]->likelihood;
+		if(numFields > 10){
+			return false;
 		}
-		
-		for(unsigned int index = 0; index < genusNodes.size(); index++){
-			if(genusSum != 0){
-				genusNodes[index]->likelihood /= genusSum;
-			}else{
-				genusNodes[index]->likelihood = 1.0;
-			}
+	}
+	for(int lineNum = 0; lineNum < 4 && p < end; lineNum++){
+		p = lineEnd;
+		lineEnd = nextLine(p, end);
+	}
+	p = lineEnd;
+	return p == end || parseClusterHeader(p, nextLine(p, end), &clstrID, &clstrSize);
+}
+
+static size_t alignToCluster(const char *data, size_t size, size_t pos){
+	pos = alignToLine(data, size, pos);
+	while(pos < size && !isClusterStart(data, size, pos)){
+		pos = nextLine(data + pos, data + size) - data;
+	}
+	return pos;
+}
+
+static void scanGI2ClstrChunk(int chunk, void *arg){
+	gi2ClstrScan_st *scan = (gi2ClstrScan_st *) arg;
+	const char *fileEnd = scan->file->data + scan->file->size;
+	const char *p = scan->file->data + scan->boundaries[chunk];
+	const char *end = scan->file->data + scan->boundaries[chunk+1];
+	clusterChunk_st &result = scan->chunks[chunk];
+	map<IDnum, char> parsed;
+	vector<float> values;
+	
+	// records are owned by the chunk their header starts in;
+	while(p < end){
+		const char *lineEnd = nextLine(p, fileEnd);
+		long clstrID, clstrSize;
+		if(!parseClusterHeader(p, lineEnd, &clstrID, &clstrSize)){
+			p = lineEnd;
+			continue;
 		}
+		p = lineEnd;
+		long numLines = (clstrSize + 9) / 10;
 		
-		//species level;
-		for(unsigned int index = 0; index < speciesNodes.size(); index++){
-			speciesSum += speciesNodes[index]->likelihood;
+		//lines with all members of the gene cluster
+		bool hasThisClstr = false;
+		for(long lineNum = 0; lineNum < numLines && p < fileEnd; lineNum++){
+			lineEnd = nextLine(p, fileEnd);
+			for(const char *field = p; field < lineEnd; ){
+				const char *fieldEnd = (const char *) memchr(field, '\t', lineEnd - field);
+				if(fieldEnd == NULL){
+					fieldEnd = lineEnd;
+				}
+				long GI;
+				if(parseIntField(field, fieldEnd, &GI) != NULL && scan->gi2clstr->count(GI) != 0){
+					hasThisClstr = true;
+					result.hits.push_back(pair<RefID, IDnum> (GI, clstrID));
+				}
+				field = fieldEnd + 1;
+			}
+			p = lineEnd;
 		}
 		
-		for(unsigned int index = 0; index < speciesNodes.size(); index++){
-			if(speciesSum != 0){
-				speciesNodes[index]->likelihood /= speciesSum;
-			}else{
-				speciesNodes[index]->likelihood = 1.0;
+		// phylum/genus/species parameters of this cluster, parsed once here
+		// rather than once per hit;
+		if(hasThisClstr and parsed.count(clstrID) == 0){
+			parsed[clstrID] = 1;
+			vector<float> hist[3];
+			unsigned int numBins = 0;
+			for(int rank = 0; rank < 4 && p < fileEnd; rank++){
+				lineEnd = nextLine(p, fileEnd);
+				parseTabFloats(p, lineEnd, (rank < 3)?hist[rank]:values);
+				if(rank < 3 && hist[rank].size() > numBins){
+					numBins = hist[rank].size();
+				}
+				p = lineEnd;
+			}
+			values.resize(3, -1.0);
+			
+			result.paraIDs.push_back(clstrID);
+			result.paras.push_back(vector<float>());
+			vector<float> &store = result.paras.back();
+			store.reserve(3*numBins + 3);
+			for(int rank = 0; rank < 3; rank++){
+				hist[rank].resize(numBins, 1.0);
+				store.insert(store.end(), hist[rank].begin(), hist[rank].end());
+			}
+			store.insert(store.end(), values.begin(), values.begin() + 3);
+		}else{
+			for(int i = 0; i < 4 && p < fileEnd; i++){
+				p = nextLine(p, fileEnd);
 			}
 		}
-	}//end of for loop;
-	
-	//end of function;
+	}
 }
 
-// output results
-void writeResultsToOutputFile(const char* outfile, TaxonTree *tTree, TaxonName *tName, 
-									vector<Sequence> &QuerySeq, float thr){
+// resolve the GIs keyed in gi2clstr and keep the parameters of the clusters
+// they belong to, scanning the file on numThreads threads;
+static void resolveGI2ClstrFromFile(const char* gi2clstrFile, map<RefID, IDnum> &gi2clstr,
+									map<IDnum, vector<float> > &paraStore, int numThreads){
+	map<IDnum, vector<float> >::iterator psit;
 	
-	ofstream outputFile;
-	outputFile.open(outfile, ios::out);
+	gi2ClstrScan_st scan;
+	scan.file = mapTextFile(gi2clstrFile);
+	scan.boundaries = chunkBoundaries(scan.file, numThreads, MIN_SCAN_CHUNK, alignToCluster);
+	scan.gi2clstr = &gi2clstr;
+	scan.chunks.resize(scan.boundaries.size() - 1);
+	scanChunksInParallel(scan.chunks.size(), scanGI2ClstrChunk, &scan);
+	unmapTextFile(scan.file);
 	
-	for(unsigned int seqIndex = 0; seqIndex < QuerySeq.size(); seqIndex++){
-		// start with species level;
-		vector<PathNode*> speciesNodes;
-		map<IDnum, PathNode*>::iterator forestIt;
-		string seqName = QuerySeq[seqIndex].seqName;
-		
-		for(forestIt = QuerySeq[seqIndex].seqTaxonForest.begin(); 
-			forestIt != QuerySeq[seqIndex].seqTaxonForest.end(); forestIt++){
-			PathNode* node = forestIt->second;
-			if(node->category == 3){
-				speciesNodes.push_back(node);
-			}
+	// merge in file order: a GI belongs to the last cluster listing it, and the
+	// first record of a cluster ID provides its parameters;
+	for(unsigned int chunk = 0; chunk < scan.chunks.size(); chunk++){
+		clusterChunk_st &result = scan.chunks[chunk];
+		for(unsigned int index = 0; index < result.hits.size(); index++){
+			gi2clstr.find(result.hits[index].first)->second = result.hits[index].second;
 		}
-		
-		float maxSpeciesLLH = 0;
-		IDnum speciesID;
-		for(unsigned int index = 0; index < speciesNodes.size(); index++){
-			float likelihood = speciesNodes[index]->likelihood;
-			IDnum taxonID = speciesNodes[index]->taxonID;
-			if(likelihood > maxSpeciesLLH){
-				maxSpeciesLLH = likelihood;
-				speciesID = taxonID;
+		for(unsigned int index = 0; index < result.paraIDs.size(); index++){
+			if(paraStore.count(result.paraIDs[index]) != 0){
+				continue;
 			}
+			psit = paraStore.insert(paraStore.begin(), pair<IDnum, vector<float> > (result.paraIDs[index], vector<float>()));
+			psit->second.swap(result.paras[index]);
 		}
-		
-		if(maxSpeciesLLH > thr){
-			vector<NameRank> path = taxonomyPath(tTree, tName, speciesID);
-			string pathString = taxonomyPathString(path);
-			// write to file;
-			outputFile << seqName << "\tSpecies\t" << maxSpeciesLLH << "\t" << speciesID << endl;
-			outputFile << pathString << endl;
+	}
+}
+
+// point a ClusterPara at each stored parameter vector;
+static void buildClusterParas(map<IDnum, vector<float> > &paraStore, map<IDnum, ClusterPara> &paras){
+	map<IDnum, vector<float> >::iterator psit;
+	map<IDnum, ClusterPara>::iterator pit;
+	
+	for(psit = paraStore.begin(); psit != paraStore.end(); ++psit){
+		ClusterPara para;
+		para.numBins = (psit->second.size() - 3) / 3;
+		para.dualHist = &psit->second[0];
+		para.subMTX = &psit->second[3*para.numBins];
+		pit = paras.begin();
+		paras.insert(pit, pair<IDnum, ClusterPara> (psit->first, para));
+	}
+}
+
+// load gi->clstr mapping information
+void loadGI2ClstrLibFromFile(const char* gi2clstrFile, QueryBatch &QuerySeq, int numThreads){
+	map<RefID, IDnum> gi2clstr;
+	map<IDnum, vector<float> > paraStore;
+	map<IDnum, ClusterPara> paras;
+	
+	collectQueryGIs(QuerySeq, gi2clstr);
+	resolveGI2ClstrFromFile(gi2clstrFile, gi2clstr, paraStore, numThreads);
+	buildClusterParas(paraStore, paras);
+	
+	// load information onto QuerySeq
+	assignClusterParas(QuerySeq, gi2clstr, paras);
+	//end of function
+}
+
+int gi2TaxonScanThreads(const char* gi2taxonFile, const char* gi2clstrFile, int numThreads){
+	if(numThreads < 2){
+		return numThreads;
+	}
+	struct stat taxonSt, clstrSt;
+	int taxonThreads = numThreads / 2;
+	if(stat(gi2taxonFile, &taxonSt) == 0 && stat(gi2clstrFile, &clstrSt) == 0 && taxonSt.st_size + clstrSt.st_size > 0){
+		taxonThreads = (int) ((double) numThreads * taxonSt.st_size / (taxonSt.st_size + clstrSt.st_size) + 0.5);
+	}
+	if(taxonThreads < 1){
+		taxonThreads = 1;
+	}
+	if(taxonThreads > numThreads - 1){
+		taxonThreads = numThreads - 1;
+	}
+	return taxonThreads;
+}
+
+// the two libraries fill different tables, so they are scanned concurrently,
+// sharing the numThreads threads;
+void resolveGeneTablesFromFiles(const char* gi2taxonFile, const char* gi2clstrFile, GeneTables *tables, int numThreads){
+	if(numThreads < 2){
+		resolveGI2TaxonFromFile(gi2taxonFile, tables->gi2taxon, 1);
+		resolveGI2ClstrFromFile(gi2clstrFile, tables->gi2clstr, tables->paraStore, 1);
+	}else{
+		int taxonThreads = gi2TaxonScanThreads(gi2taxonFile, gi2clstrFile, numThreads);
+		thread taxonResolver(resolveGI2TaxonFromFile, gi2taxonFile, ref(tables->gi2taxon), taxonThreads);
+		resolveGI2ClstrFromFile(gi2clstrFile, tables->gi2clstr, tables->paraStore, numThreads - taxonThreads);
+		taxonResolver.join();
+	}
+	buildClusterParas(tables->paraStore, tables->paras);
+}
+
+void assignGeneTables(GeneTables *tables, QueryBatch &QuerySeq){
+	assignTaxonIDs(QuerySeq, tables->gi2taxon);
+	assignClusterParas(QuerySeq, tables->gi2clstr, tables->paras);
+}
+
+// same as loadGI2ClstrLibFromFile, from the indexes of a database image: the
+// query GIs are resolved through the GI->clusterID table and only the cluster
+// records they point to are read;
+void loadGI2ClstrLibFromImage(DBImage *image, QueryBatch &QuerySeq){
+	map<RefID, IDnum> gi2clstr;
+	map<RefID, IDnum>::iterator it;
+	map<IDnum, ClusterPara> paras;
+	map<IDnum, ClusterPara>::iterator pit;
+	
+	collectQueryGIs(QuerySeq, gi2clstr);
+	
+	DBPairIndex index;
+	dbOpenPairIndex(image, DB_SECT_GI2CLUSTER, DB_SECT_GI2CLUSTER_VALUES, DB_SECT_GI2CLUSTER_INDEX, &index);
+	
+	for(it = gi2clstr.begin(); it != gi2clstr.end(); ++it){
+		if(!dbLookupPairIndex(&index, it->first, &it->second) || paras.count(it->second) != 0){
 			continue;
 		}
-		
-		// no species level satisfies threshold, continue to genus level;
-		vector<PathNode*> genusNodes;
-		
-		for(forestIt = QuerySeq[seqIndex].seqTaxonForest.begin(); 
-			forestIt != QuerySeq[seqIndex].seqTaxonForest.end(); forestIt++){
-			PathNode* node = forestIt->second;
-			if(node->category == 2){
-				genusNodes.push_back(node);
-			}
+		const DBClusterRecord *record = dbFindClusterRecord(image, it->second);
+		if(record == NULL){
+			it->second = 0;
+			continue;
 		}
-		
-		float maxGenusLLH = 0;
-		IDnum genusID;
-		for(unsigned int index = 0; index < genusNodes.size(); index++){
-			float likelihood = genusNodes[index]->likelihood;
-			IDnum taxonID = genusNodes[index]->taxonID;
-			if(likelihood > maxGenusLLH){
-				maxGenusLLH = likelihood;
-				genusID = taxonID;
-			}
+		// the compiled histograms are used in place;
+		ClusterPara para;
+		para.numBins = record->numBins;
+		para.dualHist = (const float *) (record + 1);
+		para.subMTX = para.dualHist + 3 * record->numBins;
+		pit = paras.begin();
+		paras.insert(pit, pair<IDnum, ClusterPara> (it->second, para));
+	}
+	
+	// load information onto QuerySeq
+	assignClusterParas(QuerySeq, gi2clstr, paras);
+}
+
+// empty accumulator of 64 slots;
+static void initScoreAccumulator(ScoreAccumulator &accum){
+	accum.slots.assign(64, -1);
+}
+
+// slot of taxonID, or of the empty slot where it belongs;
+static inline unsigned int accumulatorSlot(const ScoreAccumulator &accum, IDnum taxonID){
+	unsigned int mask = accum.slots.size() - 1;
+	unsigned int slot = ((uint32_t) taxonID * 2654435769u) & mask;
+	while(accum.slots[slot] >= 0 && accum.taxonIDs[accum.slots[slot]] != taxonID){
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+// double the table, keeping it at most half full;
+static void growScoreAccumulator(ScoreAccumulator &accum){
+	accum.slots.assign(2 * accum.slots.size(), -1);
+	for(unsigned int entry = 0; entry < accum.taxonIDs.size(); entry++){
+		unsigned int slot = accumulatorSlot(accum, accum.taxonIDs[entry]);
+		accum.slots[slot] = entry;
+		accum.entrySlot[entry] = slot;
+	}
+}
+
+// the entry of taxonID, added with the given category if absent; -1 for
+// taxonID 0, a rank missing from the lineage;
+static int accumulatorEntry(ScoreAccumulator &accum, IDnum taxonID, int category){
+	if(taxonID == 0){
+		return -1;
+	}
+	unsigned int slot = accumulatorSlot(accum, taxonID);
+	if(accum.slots[slot] >= 0){
+		return accum.slots[slot];
+	}
+	int entry = accum.taxonIDs.size();
+	accum.slots[slot] = entry;
+	accum.taxonIDs.push_back(taxonID);
+	accum.likelihood.push_back(0.0);
+	accum.entrySlot.push_back(slot);
+	accum.lanes[category-1].push_back(entry);
+	if(2 * accum.taxonIDs.size() > accum.slots.size()){
+		growScoreAccumulator(accum);
+	}
+	return entry;
+}
+
+// forget the entries, in the time it takes to list them;
+static void clearScoreAccumulator(ScoreAccumulator &accum){
+	for(unsigned int entry = 0; entry < accum.entrySlot.size(); entry++){
+		accum.slots[accum.entrySlot[entry]] = -1;
+	}
+	accum.taxonIDs.clear();
+	accum.likelihood.clear();
+	accum.entrySlot.clear();
+	for(int lane = 0; lane < 3; lane++){
+		accum.lanes[lane].clear();
+	}
+}
+
+// orders the entries of a lane by taxonID;
+struct laneOrder_st{
+	const ScoreAccumulator *accum;
+	
+	bool operator()(unsigned int a, unsigned int b) const{
+		return accum->taxonIDs[a] < accum->taxonIDs[b];
+	}
+};
+
+// what the threads of likelihoodCal share;
+struct likelihoodJob_st{
+	TaxonTree *tTree;
+	QueryBatch *QuerySeq;
+	vector<ScoreAccumulator> accumulators;  // one per thread
+	const ScoreKernels *kernels;
+	ScoreWeights weights;
+};
+
+// all weights 1, the defaults, whose scores need no multiplication;
+static bool unitScoreWeights(const ScoreWeights &weights){
+	for(int rank = 0; rank < 3; rank++){
+		if(weights.dualHist[rank] != 1 || weights.subMTX[rank] != 1){
+			return false;
 		}
-		
-		if(maxGenusLLH > thr){
-			vector<NameRank> path = taxonomyPath(tTree, tName, genusID);
-			string pathString = taxonomyPathString(path);
-			// write to file;
-			outputFile << seqName << "\tGenus\t" << maxGenusLLH << "\t" << genusID << endl;
-			outputFile << pathString << endl;
+	}
+	return true;
+}
+
+// calculate the likelihood of taxonomy for one query sequence; unitWeights
+// picks the scoring kernel at compile time, for all the sequences of a run;
+template<bool unitWeights>
+static void scoreQuerySequence(size_t seqIndex, int thread, void *arg){
+	likelihoodJob_st *job = (likelihoodJob_st *) arg;
+	TaxonTree *tTree = job->tTree;
+	QueryBatch &QuerySeq = *job->QuerySeq;
+	ScoreAccumulator &accum = job->accumulators[thread];
+	Sequence &seq = QuerySeq.seqs[seqIndex];
+	unsigned int endHit = seq.firstHit + seq.numHits;
+	
+	// resolve every hit to the entries of the taxa on its lineage; hits of
+	// unknown taxa or with a rank missing from their lineage are not scored;
+	clearScoreAccumulator(accum);
+	accum.hitEntries.resize(3 * seq.numHits);
+	for(unsigned int hit = seq.firstHit; hit < endHit; hit++){
+		const TaxonLineage *lineage = taxonLineage(tTree, QuerySeq.taxonIDs[hit]);
+		int *entries = &accum.hitEntries[3 * (hit - seq.firstHit)];
+		entries[0] = accumulatorEntry(accum, lineage->phylum, 1);
+		entries[1] = accumulatorEntry(accum, lineage->genus, 2);
+		entries[2] = accumulatorEntry(accum, lineage->species, 3);
+	}
+	
+	// weight the dual histogram and subMTX values of all hits at once, then
+	// add the scores up in input order;
+	accum.hitScores.resize(3 * seq.numHits);
+	const float *dualHist = QuerySeq.dualHist.data() + 3 * seq.firstHit;
+	const float *subMTX = QuerySeq.subMTX.data() + 3 * seq.firstHit;
+	if(unitWeights){
+		job->kernels->addHitScores(dualHist, subMTX, seq.numHits, accum.hitScores.data());
+	}else{
+		job->kernels->weightHitScores(dualHist, subMTX, seq.numHits, job->weights.dualHist, job->weights.subMTX, accum.hitScores.data());
+	}
+	for(unsigned int index = 0; index < 3 * seq.numHits; index += 3){
+		const int *entries = &accum.hitEntries[index];
+		if(entries[0] < 0 or entries[1] < 0 or entries[2] < 0){
 			continue;
 		}
+		accum.likelihood[entries[0]] += accum.hitScores[index];
+		accum.likelihood[entries[1]] += accum.hitScores[index+1];
+		accum.likelihood[entries[2]] += accum.hitScores[index+2];
+	}
+	
+	// normalize the scores of each rank into likelihoods, summing them in
+	// taxonID order, and keep the best; the first one wins ties;
+	laneOrder_st byTaxonID;
+	byTaxonID.accum = &accum;
+	for(int lane = 0; lane < 3; lane++){
+		vector<unsigned int> &entries = accum.lanes[lane];
+		sort(entries.begin(), entries.end(), byTaxonID);
 		
-		// no genus level satisfies threshold, continue to phylum level;
-		vector<PathNode*> phylumNodes;
-		
-		for(forestIt = QuerySeq[seqIndex].seqTaxonForest.begin(); 
-			forestIt != QuerySeq[seqIndex].seqTaxonForest.end(); forestIt++){
-			PathNode* node = forestIt->second;
-			if(node->category == 1){
-				phylumNodes.push_back(node);
-			}
+		float sum = 0;
+		accum.laneScores.resize(entries.size());
+		for(unsigned int index = 0; index < entries.size(); index++){
+			accum.laneScores[index] = accum.likelihood[entries[index]];
+			sum += accum.laneScores[index];
 		}
 		
-		float maxPhylumLLH = 0;
-		IDnum phylumID;
-		for(unsigned int index = 0; index < phylumNodes.size(); index++){
-			float likelihood = phylumNodes[index]->likelihood;
-			IDnum taxonID = phylumNodes[index]->taxonID;
-			if(likelihood > maxPhylumLLH){
-				maxPhylumLLH = likelihood;
-				phylumID = taxonID;
+		size_t best = job->kernels->normalizeScores(accum.laneScores.data(), entries.size(), sum);
+		if(best < entries.size()){
+			seq.bestTaxon[lane] = accum.taxonIDs[entries[best]];
+			seq.bestLikelihood[lane] = accum.laneScores[best];
+		}else{
+			seq.bestTaxon[lane] = 0;
+			seq.bestLikelihood[lane] = 0;
+		}
+	}
+	//end of function;
+}
+
+// calculate the likelihood of taxonomy for query sequences; a sequence only
+// writes to its own results, so they are scored on numThreads threads, and
+// the results do not depend on the number of threads;
+void likelihoodCal(TaxonTree *tTree, QueryBatch &QuerySeq, int numThreads, const ScoreWeights *weights){
+	likelihoodJob_st job;
+	job.tTree = tTree;
+	job.QuerySeq = &QuerySeq;
+	job.kernels = scoreKernels();
+	QuerySeq.model = MODEL_LIKELIHOOD;
+	if(weights != NULL){
+		job.weights = *weights;
+	}else{
+		initScoreWeights(job.weights);
+	}
+	job.accumulators.resize((numThreads < 1)?1:numThreads);
+	for(unsigned int thread = 0; thread < job.accumulators.size(); thread++){
+		initScoreAccumulator(job.accumulators[thread]);
+	}
+	if(unitScoreWeights(job.weights)){
+		runWorkStealing(QuerySeq.seqs.size(), numThreads, scoreQuerySequence<true>, &job);
+	}else{
+		runWorkStealing(QuerySeq.seqs.size(), numThreads, scoreQuerySequence<false>, &job);
+	}
+}
+
+struct lcaJob_st{
+	LCAIndex *lcaIndex;
+	QueryBatch *QuerySeq;
+};
+
+static void lcaQuerySequence(size_t seqIndex, int thread, void *arg){
+	lcaJob_st *job = (lcaJob_st *) arg;
+	QueryBatch &QuerySeq = *job->QuerySeq;
+	Sequence &seq = QuerySeq.seqs[seqIndex];
+	size_t numFound;
+	seq.lcaTaxon = lcaOfSet(job->lcaIndex, QuerySeq.taxonIDs.data() + seq.firstHit, seq.numHits, &numFound);
+	seq.lcaSupport = (seq.numHits > 0)?(float) numFound / seq.numHits:0;
+}
+
+void lcaCal(LCAIndex *lcaIndex, QueryBatch &QuerySeq, int numThreads){
+	lcaJob_st job;
+	job.lcaIndex = lcaIndex;
+	job.QuerySeq = &QuerySeq;
+	QuerySeq.model = MODEL_LCA;
+	runWorkStealing(QuerySeq.seqs.size(), numThreads, lcaQuerySequence, &job);
+}
+
+// pick the most specific rank whose best likelihood exceeds thr, or the LCA
+// below the root if its support does; LCA ranks are capitalized like the
+// likelihood ones;
+static Assignment assignTaxonomy(TaxonTree *tTree, Sequence &seq, int model, float thr){
+	static const char *rankLabels[4] = {"Unknown", "Phylum", "Genus", "Species"};
+	Assignment assignment;
+	
+	if(model == MODEL_LCA){
+		if(seq.lcaTaxon > 1 && seq.lcaSupport > thr){
+			assignment.rank = rankName(tTree, tTree->rank[seq.lcaTaxon]);
+			if(assignment.rank.empty()){
+				assignment.rank = "no rank";
 			}
+			assignment.rank[0] = toupper(assignment.rank[0]);
+			assignment.likelihood = seq.lcaSupport;
+			assignment.taxonID = seq.lcaTaxon;
+			return assignment;
 		}
-		
-		if(maxPhylumLLH > thr){
-			vector<NameRank> path = taxonomyPath(tTree, tName, phylumID);
-			string pathString = taxonomyPathString(path);
-			// write to file;
-			
-			outputFile << seqName << "\tPhylum\t" << maxPhylumLLH << "\t" << phylumID << endl;
-			outputFile << pathString << endl;
-			continue;
+		assignment.rank = rankLabels[0];
+		assignment.likelihood = 0;
+		assignment.taxonID = 0;
+		return assignment;
+	}
+	
+	for(int category = 3; category >= 1; category--){
+		float maxLLH = seq.bestLikelihood[category-1];
+		if(maxLLH > thr){
+			assignment.rank = rankLabels[category];
+			assignment.likelihood = maxLLH;
+			assignment.taxonID = seq.bestTaxon[category-1];
+			return assignment;
 		}
-		
-		// no phylum level satisfies threshold, mark as novel;
-		// write to file as novel;
-		
-		outputFile << seqName << "\tUnknown\tNA\tNA" << endl;
-		outputFile << "NA" << endl;
 	}
 	
+	// no phylum level satisfies threshold, mark as novel;
+	assignment.rank = rankLabels[0];
+	assignment.likelihood = 0;
+	assignment.taxonID = 0;
+	return assignment;
+}
+
+// output results
+void writeResultsToOutputFile(const char* outfile, TaxonTree *tTree, TaxonName *tName, 
+									QueryBatch &QuerySeq, float thr, unsigned int firstSeq, unsigned int endSeq){
+	ofstream outputFile;
+	outputFile.open(outfile, ios::out);
+	writeResults(outputFile, tTree, tName, QuerySeq, thr, firstSeq, endSeq);
 	outputFile.close();
 }
 
+void writeResults(ostream &outputFile, TaxonTree *tTree, TaxonName *tName,
+									QueryBatch &QuerySeq, float thr, unsigned int firstSeq, unsigned int endSeq){
+	vector<Assignment> assignments;
+	vector<IDnum> printedTaxa;
+	
+	if(endSeq > QuerySeq.seqs.size()){
+		endSeq = QuerySeq.seqs.size();
+	}
+	
+	// decide first, so that only the names actually printed are loaded;
+	for(unsigned int seqIndex = firstSeq; seqIndex < endSeq; seqIndex++){
+		Assignment assignment = assignTaxonomy(tTree, QuerySeq.seqs[seqIndex], QuerySeq.model, thr);
+		assignments.push_back(assignment);
+		if(assignment.taxonID != 0){
+			vector<IDnum> path = taxonomyPath(tTree, assignment.taxonID);
+			printedTaxa.insert(printedTaxa.end(), path.begin(), path.end());
+		}
+	}
+	loadTaxonNames(tName, printedTaxa);
+	
+	for(unsigned int seqIndex = firstSeq; seqIndex < endSeq; seqIndex++){
+		Assignment &assignment = assignments[seqIndex - firstSeq];
+		const string &seqName = QuerySeq.seqs[seqIndex].seqName;
+		
+		if(assignment.taxonID == 0){
+			// write to file as novel;
+			outputFile << seqName << "\tUnknown\tNA\tNA" << endl;
+			outputFile << "NA" << endl;
+			continue;
+		}
+		
+		vector<NameRank> path = taxonomyPath(tTree, tName, assignment.taxonID);
+		string pathString = taxonomyPathString(path);
+		if(pathString.empty()){
+			// an LCA above every printed rank, such as "cellular organisms";
+			pathString = "NA";
+		}
+		// write to file;
+		outputFile << seqName << "\t" << assignment.rank << "\t" << assignment.likelihood << "\t" << assignment.taxonID << endl;
+		outputFile << pathString << endl;
+	}
+}
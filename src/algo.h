@@ -10,104 +10,275 @@
 
 #include<vector>
 #include<map>
+#include<unordered_map>
+#include<string>
+#include<iostream>
 #include<algorithm>
+#include<climits>
 
 #include "globals.h"
 #include "taxonomy.h"
 #include "utility.h"
 
-struct pathNode_st{
-	IDnum taxonID;
+// parsed parameters of a gene cluster, shared by all hits to its members;
+struct clusterPara_st{
+	unsigned int numBins;
+	const float *dualHist;  // phylum, genus and species histograms, numBins each
+	const float *subMTX;    // phylum, genus and species
+	
+	float histPara(int rank, float identity) const;
+};
+
+// classification models, see --mode;
+#define MODEL_LIKELIHOOD 0
+#define MODEL_LCA 1
+
+// taxonomic assignment of a query sequence, taxonID is 0 when unknown;
+struct assignment_st{
+	string rank;        // "Species", "Genus", "Phylum" or "Unknown"; any rank for MODEL_LCA
 	float likelihood;
-	int category; // 0->root, 1->phylum, 2->genus, 3->species;
-	pathNode_st *prevNode;
+	IDnum taxonID;
+};
+
+// a predicted gene: the contig it lies on and its length in amino acids;
+struct geneLocus_st{
+	string contig;
+	double length;
+};
+
+// raw 12-column BLAST/DIAMOND tabular input, whose hits are mapped onto
+// their query contigs through a gene prediction file as
+// utils/infile_convert.pl does;
+struct inputFormat_st{
+	bool mapGenes;              // false for format "no": each gene is its own query
+	double minAlignedFraction;  // of the gene length, for a hit to be kept
+	unordered_map<string, GeneLocus> genes;
+};
+
+// which of the input hits are kept; initHitFilter() sets the defaults of
+// globals.h. The taxon lists drop hits as they are read, before the best
+// ones of each gene are selected, as if those taxa were missing from the
+// reference database; they need a labelled tTree and the taxa of the input
+// GIs, looked up in the image or, without one, in gi2taxon;
+struct hitFilter_st{
+	unsigned int maxHitsPerGene;    // best bitscores kept per gene, 0 for all
+	double minIdentity;
+	double minBitscore;
+	double scoreDropThr;            // of the bitscore drop rule
+	vector<IDnum> includeTaxa;      // if any, only hits under one of them are kept
+	vector<IDnum> excludeTaxa;      // hits under any of them are dropped
+	TaxonTree *tTree;
+	DBImage *image;
+	const map<RefID, IDnum> *gi2taxon;  // resolved for the GIs of collectInputGIs()
+};
+
+// weights of the dual histogram and subMTX scores of phylum, genus and
+// species (W10-W12 and W20-W22); initScoreWeights() sets the defaults of
+// globals.h;
+struct scoreWeights_st{
+	float dualHist[3];
+	float subMTX[3];
 };
 
+// the hits kept for the gene being read: a list in input order, for the
+// bitscore drop rule, and an indexed min-heap on (bitscore, input order) for
+// the removals, so that each hit costs O(log n) in the hits kept; slots of
+// removed hits are reused;
+struct hitSelector_st{
+	vector<RefID> gis;
+	vector<IDnum> taxonIDs;     // looked up for the taxon lists of the filter, else 0
+	vector<float> identity;
+	vector<float> bitscore;
+	vector<unsigned int> order;
+	vector<int> prev;
+	vector<int> next;
+	vector<int> heapPos;
+	vector<int> heap;
+	vector<int> freeSlots;
+	int head;
+	int tail;
+	unsigned int numBigGaps;    // adjacent hits in the list more than scoreDropThr apart
+	unsigned int numInputs;
+	unsigned int capacity;      // 0 for unbounded
+	double scoreDropThr;
+};
+
+// the scores of the taxa hit by the query sequence being scored: an
+// open-addressing table from taxonID to an entry, whose entries are also
+// listed in lanes by the rank (phylum, genus, species) of the lineage they
+// were first added from; clearing it
+// only resets the slots of its entries, so each scoring thread reuses one
+// accumulator for all its sequences and stops allocating once it has grown;
+struct scoreAccumulator_st{
+	vector<int> slots;              // entry index, -1 if empty; a power of two in size
+	vector<IDnum> taxonIDs;
+	vector<float> likelihood;
+	vector<unsigned int> entrySlot;
+	vector<unsigned int> lanes[3];
+	vector<int> hitEntries;         // phylum, genus, species entry of each hit, -1 if none
+	vector<float> hitScores;        // weighted scores, three per hit
+	vector<float> laneScores;       // the scores of a lane, in taxonID order
+};
+
+// reads the input file one query sequence at a time;
+struct queryReader_st{
+	LineReader *lines;
+	InputFormat *format;        // NULL for the MyTaxa input format
+	HitFilter filter;
+	bool filterTaxa;            // filter has taxon lists
+	DBPairIndex *gi2taxonIndex; // of filter.image, for them
+	HitSelector hits;
+	string oldQuery;
+	string oldGene;
+	bool pending;       // the fields below are the first line of the next query
+	string queryName;
+	string geneName;
+	RefID geneGI;
+	float identity;
+	float bitscore;
+	IDnum taxonID;      // if looked up for the taxon lists, else 0
+};
+
+// GI->taxonID and GI->cluster parameters, resolved from the text libraries
+// for a set of query GIs before the queries themselves are read;
+struct geneTables_st{
+	map<RefID, IDnum> gi2taxon;
+	map<RefID, IDnum> gi2clstr;
+	map<IDnum, vector<float> > paraStore;   // three dual histograms, then the 3 subMTX values
+	map<IDnum, ClusterPara> paras;
+};
+
+// a query sequence of a QueryBatch: its genes and hits are ranges of the
+// batch columns;
 struct sequence_st{
 	string seqName;
-	vector<Gene> genes;
-	map<IDnum, PathNode*> seqTaxonForest;
+	unsigned int firstGene;
+	unsigned int numGenes;
+	unsigned int firstHit;
+	unsigned int numHits;
+	IDnum bestTaxon[3];         // highest phylum, genus and species likelihoods, set
+	float bestLikelihood[3];    // by likelihoodCal; taxon 0 and likelihood 0 if none
+	IDnum lcaTaxon;             // set by lcaCal: the LCA of the taxa of the hits, 0 if
+	float lcaSupport;           // none is known, and the fraction of hits of known taxa
 	
-	void printSeq();
+	void printSeq(const QueryBatch &batch);
 };
 
-struct gene_st{
-	vector<IDnum> gis;
+// query sequences and their hits, stored column by column, one entry per hit
+// (three for dualHist and subMTX: phylum, genus, species); a gene is the range
+// of hits from its geneStarts entry to the next gene's, or the end of its
+// sequence. clearQueryBatch() keeps the memory of the columns, so reading
+// batch after batch into the same QueryBatch stops allocating once the
+// columns have grown to the size of a batch;
+struct queryBatch_st{
+	vector<Sequence> seqs;
+	vector<unsigned int> geneStarts;
+	vector<RefID> gis;
 	vector<float> identity;
 	vector<float> bitscore;
-	vector<IDnum> clusters;
+	vector<IDnum> taxonIDs;     // filled by the GI->taxonID loaders, or by readers with taxon lists
+	vector<IDnum> clusters;     // filled by the GI->cluster loaders, with the two below
 	vector<float> dualHist;
 	vector<float> subMTX;
-	vector<IDnum> taxonIDs;
-	
-	float min_current_bitscore(){
-		if(bitscore.size() == 0){
-			return 0;
-		}
-		float min = 100000;
-		for(vector<float>::iterator it = bitscore.begin(); it != bitscore.end(); ++it){
-			if(min > *it){
-				min = *it;
-			}
-		}
-		return min;
-	}
-	
-	float max_gap(){
-		float max_gap = 0;
-		for(unsigned int i = 0; i < bitscore.size() - 1; ++i){
-			float min, max;
-			min = (bitscore[i] < bitscore[i+1])?bitscore[i]:bitscore[i+1];
-			max = (bitscore[i] > bitscore[i+1])?bitscore[i]:bitscore[i+1];
-			float g = (max-min)/max;
-			if(g > max_gap){
-				max_gap = g;
-			}
-		}
-		return max_gap;
-	}
-	
-	void remove_min(){
-		unsigned int min_index = 0;
-		float min = 10000;
-		for(vector<float>::iterator it = bitscore.begin(); it != bitscore.end(); ++it){
-			if(min > *it){
-				min = *it;
-				min_index = it - bitscore.begin();
-			}
-		}
-		gis.erase(min_index + gis.begin());
-		bitscore.erase(min_index + bitscore.begin());
-		identity.erase(min_index + identity.begin());
-	}
-	
-	void organize_entries(){
-		if(gis.size() < 2){
-			return;
-		}
-		if(max_gap() > SCORE_DROP_THR){
-			remove_min();
-		}
-	}
+	int model;                  // that scored the sequences, MODEL_LIKELIHOOD or MODEL_LCA
 };
 
-// initializers and destroyers;
-Sequence *newSequence();
-Gene *newGene();
-PathNode *newPathNode();
+// empty the batch, keeping its memory;
+void clearQueryBatch(QueryBatch &QuerySeq);
 
 vector<string> split(string s, char delim);
 
-// load information from input file
-vector<Sequence> loadInfoFromInputFile(const char* infile);
+// parse a line of tab delimited numbers; the first form stops at end, the
+// second at the terminating NUL;
+void parseTabFloats(const char *line, const char *end, vector<float> &values);
+
+void parseTabFloats(const char *line, vector<float> &values);
+
+// load the genes of a prediction file in format "gff2", "gff3" or "tab"
+// (gene, length in nucleotides, contig), or none for format "no"; exits on
+// unreadable files and unparsable lines;
+InputFormat *loadGenePredictions(const char* geneFile, const char* format, double minAlignedFraction);
+
+void destroyInputFormat(InputFormat *format);
+
+void initHitFilter(HitFilter &filter);
+
+void initScoreWeights(ScoreWeights &weights);
+
+// read "<name> <value>" lines into weights and filter, names being those of
+// the defaults in globals.h (W10 ... W22, SCORE_DROP_THR, MIN_IDENTITY,
+// MIN_BITSCORE); "#" starts a comment; exits on unreadable files, unknown
+// names and unparsable values;
+void loadScoringParams(const char* paramFile, ScoreWeights &weights, HitFilter &filter);
+
+// load information from input file into QuerySeq, in the MyTaxa format unless
+// a tabular search output format is given;
+void loadInfoFromInputFile(const char* infile, QueryBatch &QuerySeq, InputFormat *format = NULL, HitFilter *filter = NULL);
+
+// incremental reading of the input file, exits if it cannot be opened or
+// read, unless error is given: see openInputStream(); a NULL filter is the
+// default one;
+QueryReader *openQueryReader(const char* infile, InputFormat *format = NULL, HitFilter *filter = NULL, string *error = NULL);
+
+// append the next query sequence to QuerySeq, false at the end of the input;
+bool readQuerySequence(QueryReader *reader, QueryBatch &QuerySeq);
 
-void loadGI2TaxonLibFromFile(const char* gi2taxonFile, vector<Sequence> &QuerySeq);
+// the read or decoding error that ended the input, empty if none;
+const string &queryReaderError(QueryReader *reader);
 
-void loadGI2ClstrLibFromFile(const char* gi2clstrFile, vector<Sequence> &QuerySeq);
+// query sequences held at once by a --stream run or a server job;
+#define STREAM_WINDOW 1024
 
-void likelihoodCal(TaxonTree *tTree, vector<Sequence> &QuerySeq);
+// append up to maxSeqs query sequences, returns the number read;
+unsigned int readQuerySequences(QueryReader *reader, QueryBatch &QuerySeq, unsigned int maxSeqs);
 
+void closeQueryReader(QueryReader *reader);
+
+// add the GIs of all the input hits that pass the identity and bitscore
+// filters, selected or not, to giHits, mapped to 0: those the taxon lists of
+// the filter need;
+void collectInputGIs(const char* infile, InputFormat *format, HitFilter *filter, map<RefID, IDnum> &giHits);
+
+// add the GIs of all hits in QuerySeq to giHits, mapped to 0;
+void collectQueryGIs(QueryBatch &QuerySeq, map<RefID, IDnum> &giHits);
+
+// the text libraries are scanned by numThreads threads;
+void loadGI2TaxonLibFromFile(const char* gi2taxonFile, QueryBatch &QuerySeq, int numThreads);
+
+void loadGI2ClstrLibFromFile(const char* gi2clstrFile, QueryBatch &QuerySeq, int numThreads);
+
+// of numThreads threads scanning both text libraries at once, those for
+// gi2taxonFile, in proportion to its size and leaving at least one to each;
+int gi2TaxonScanThreads(const char* gi2taxonFile, const char* gi2clstrFile, int numThreads);
+
+// resolve the GIs keyed in tables->gi2taxon and tables->gi2clstr from the
+// text libraries, on numThreads threads in all, then load them onto any
+// QuerySeq whose GIs were keyed;
+void resolveGeneTablesFromFiles(const char* gi2taxonFile, const char* gi2clstrFile, GeneTables *tables, int numThreads);
+
+void assignGeneTables(GeneTables *tables, QueryBatch &QuerySeq);
+
+// same loaders, from a compiled database image (see dbimage.h); the taxa
+// are kept as they are if the reader looked them all up already;
+void loadGI2TaxonLibFromImage(DBImage *image, QueryBatch &QuerySeq);
+
+void loadGI2ClstrLibFromImage(DBImage *image, QueryBatch &QuerySeq);
+
+// the query sequences are scored on numThreads threads, with the same results
+// for any number of threads; NULL weights are the default ones;
+void likelihoodCal(TaxonTree *tTree, QueryBatch &QuerySeq, int numThreads = 1, const ScoreWeights *weights = NULL);
+
+// the fast alternative of --mode lca: each query sequence goes to the LCA of
+// the taxa of its hits, supported by the fraction of its hits of known taxa;
+void lcaCal(LCAIndex *lcaIndex, QueryBatch &QuerySeq, int numThreads = 1);
+
+// the results of the query sequences [firstSeq, endSeq) of QuerySeq: the
+// most specific rank whose likelihood, or the LCA if its support, exceeds thr;
 void writeResultsToOutputFile(const char* outfile, TaxonTree *tTree, TaxonName *tName,
-								 vector<Sequence> &QuerySeq, float thr);
+								 QueryBatch &QuerySeq, float thr, unsigned int firstSeq = 0, unsigned int endSeq = UINT_MAX);
+
+// same, appending to an open stream;
+void writeResults(ostream &outputFile, TaxonTree *tTree, TaxonName *tName,
+								 QueryBatch &QuerySeq, float thr, unsigned int firstSeq = 0, unsigned int endSeq = UINT_MAX);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,281 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+// Microbenchmark of the text database parsers, built by "make bench":
+//
+//	MyTaxaBench <db directory> [repeats]
+//
+// For ncbiNodes.lib, ncbiSciNames.lib and geneTaxon.lib it reports the lines
+// per second of the former fgets()+stringstream/split() parsing, of the
+// LineReader field scanner extracting the same fields, and of the loader.
+// It then times the scoring kernels of each instruction set level the CPU
+// supports on random hits, and checks their results against the scalar ones.
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "taxonomy.h"
+#include "algo.h"
+#include "textscan.h"
+#include "scorekernel.h"
+#include "globals.h"
+
+using namespace std;
+
+static double now(){
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// parsers return the number of lines read; the checksum keeps the parsed
+// fields alive;
+long checksum = 0;
+
+static FILE *openOrExit(const char *path){
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL){
+		cerr << "Could not open file: " << path << endl;
+		exit(EXIT_FAILURE);
+	}
+	return fp;
+}
+
+// <taxonID> <parent> <rank>, as importTaxonTreeFromFile used to read it;
+static long legacyNodes(const char *path){
+	FILE *fp = openOrExit(path);
+	char line[20000];
+	long numLines = 0;
+	IDnum currentNode, prevNode;
+	while(fgets(line, sizeof(line), fp) != NULL){
+		string tmpA, tmpB;
+		stringstream streamLine;
+		streamLine << line;
+		streamLine >> currentNode >> prevNode >> tmpA >> tmpB;
+		checksum += currentNode + prevNode + tmpA.size() + tmpB.size();
+		numLines++;
+	}
+	fclose(fp);
+	return numLines;
+}
+
+static long scanNodes(const char *path){
+	LineReader *reader = openLineReader(path);
+	const char *line;
+	size_t length;
+	long numLines = 0;
+	while(readLine(reader, &line, &length)){
+		TextField fields[3];
+		long currentNode = 0, prevNode = 0;
+		int numFields = splitFields(line, line + length, '\t', fields, 3);
+		parseIntField(fields[0].begin, fields[0].end, &currentNode);
+		if(numFields > 1){
+			parseIntField(fields[1].begin, fields[1].end, &prevNode);
+		}
+		checksum += currentNode + prevNode + ((numFields > 2)?fields[2].end - fields[2].begin:0);
+		numLines++;
+	}
+	closeLineReader(reader);
+	return numLines;
+}
+
+// <taxonID>\t<name>, split() into fields;
+static long legacyNames(const char *path){
+	FILE *fp = openOrExit(path);
+	char line[5000];
+	long numLines = 0;
+	while(fgets(line, sizeof(line), fp) != NULL){
+		vector<string> elems = split(string(line), '\t');
+		checksum += atoi(elems[0].c_str()) + ((elems.size() > 1)?elems[1].size():0);
+		numLines++;
+	}
+	fclose(fp);
+	return numLines;
+}
+
+static long scanNames(const char *path){
+	LineReader *reader = openLineReader(path);
+	const char *line;
+	size_t length;
+	long numLines = 0;
+	while(readLine(reader, &line, &length)){
+		TextField fields[2];
+		long taxonID = 0;
+		int numFields = splitFields(line, line + length, '\t', fields, 2);
+		parseIntField(fields[0].begin, fields[0].end, &taxonID);
+		checksum += taxonID + ((numFields > 1)?fields[1].end - fields[1].begin:0);
+		numLines++;
+	}
+	closeLineReader(reader);
+	return numLines;
+}
+
+// <GI> <taxonID>, as loadGI2TaxonLibFromFile used to read it;
+static long legacyGeneTaxon(const char *path){
+	FILE *fp = openOrExit(path);
+	char line[1000];
+	long numLines = 0;
+	IDnum GI, taxonID;
+	while(fgets(line, sizeof(line), fp) != NULL){
+		stringstream streamLine;
+		streamLine << line;
+		streamLine >> GI >> taxonID;
+		checksum += GI + taxonID;
+		numLines++;
+	}
+	fclose(fp);
+	return numLines;
+}
+
+static long scanGeneTaxon(const char *path){
+	LineReader *reader = openLineReader(path);
+	const char *line;
+	size_t length;
+	long numLines = 0;
+	while(readLine(reader, &line, &length)){
+		long GI = 0, taxonID = 0;
+		const char *p = parseIntField(line, line + length, &GI);
+		if(p != NULL){
+			parseIntField(p, line + length, &taxonID);
+		}
+		checksum += GI + taxonID;
+		numLines++;
+	}
+	closeLineReader(reader);
+	return numLines;
+}
+
+static long loadNodes(const char *path){
+	destroyTaxonTree(importTaxonTreeFromFile(path));
+	return 0;
+}
+
+static long loadNames(const char *path){
+	destroyTaxonName(importTaxonNameFromFile(path));
+	return 0;
+}
+
+// a full single-threaded pass; no query GIs, so nothing is kept;
+static long loadGeneTaxon(const char *path){
+	QueryBatch QuerySeq;
+	loadGI2TaxonLibFromFile(path, QuerySeq, 1);
+	return 0;
+}
+
+// best of repeats runs, in lines per second of a file of numLines lines;
+static void report(const char *label, long (*parse)(const char *), const char *path, long numLines, int repeats){
+	double best = 0;
+	for(int run = 0; run < repeats; run++){
+		double start = now();
+		parse(path);
+		double elapsed = now() - start;
+		if(run == 0 || elapsed < best){
+			best = elapsed;
+		}
+	}
+	cout << "  " << setw(8) << left << label << right << setw(10) << fixed << setprecision(3) << best << " s"
+		<< setw(14) << setprecision(0) << ((best > 0)?numLines / best:0) << " lines/s" << endl;
+}
+
+// values in [0, 1), with some zero scores so that normalizing finds ties;
+static void randomScores(vector<float> &values, unsigned int seed){
+	srand(seed);
+	for(unsigned int i = 0; i < values.size(); i++){
+		values[i] = (rand() % 8 == 0)?0:(float) rand() / ((float) RAND_MAX + 1);
+	}
+}
+
+// best of repeats runs of weighting and normalizing numHits hits, per level;
+static void reportKernels(int repeats){
+	const unsigned int numHits = 1 << 20;
+	const float weights1[3] = {1.0, 0.5, 2.0};
+	const float weights2[3] = {0.25, 1.0, 3.0};
+	vector<float> dualHist(3 * numHits), subMTX(3 * numHits);
+	randomScores(dualHist, 1);
+	randomScores(subMTX, 2);
+
+	vector<float> scalarScores(3 * numHits), scalarSums(3 * numHits), scalarNormalized;
+	size_t scalarBest = 0;
+	cout << "scoring kernels: " << numHits << " hits" << endl;
+	for(int level = SCORE_KERNEL_SCALAR; level <= SCORE_KERNEL_BEST; level++){
+		const ScoreKernels *kernels = scoreKernels(level);
+		if(kernels->level != level){
+			break;
+		}
+		vector<float> scores(3 * numHits), sums(3 * numHits), normalized;
+		size_t best = 0;
+		double bestWeight = 0, bestNormalize = 0;
+		for(int run = 0; run < repeats; run++){
+			double start = now();
+			kernels->weightHitScores(&dualHist[0], &subMTX[0], numHits, weights1, weights2, &scores[0]);
+			double weighted = now();
+			normalized = scores;
+			double copied = now();
+			best = kernels->normalizeScores(&normalized[0], normalized.size(), 1000.0);
+			double elapsed = now();
+			if(run == 0 || weighted - start < bestWeight){
+				bestWeight = weighted - start;
+			}
+			if(run == 0 || elapsed - copied < bestNormalize){
+				bestNormalize = elapsed - copied;
+			}
+		}
+		kernels->addHitScores(&dualHist[0], &subMTX[0], numHits, &sums[0]);
+		if(level == SCORE_KERNEL_SCALAR){
+			scalarScores = scores;
+			scalarSums = sums;
+			scalarNormalized = normalized;
+			scalarBest = best;
+		}
+		bool same = (scores == scalarScores && sums == scalarSums && normalized == scalarNormalized && best == scalarBest);
+		cout << "  " << setw(8) << left << kernels->name << right << setw(10) << fixed << setprecision(3) << bestWeight << " s"
+			<< setw(14) << setprecision(0) << ((bestWeight > 0)?numHits / bestWeight:0) << " hits/s"
+			<< setw(10) << setprecision(3) << bestNormalize << " s normalizing"
+			<< (same?"":"  DIFFERS FROM SCALAR") << endl;
+	}
+}
+
+int main(int argc, char** argv){
+	if(argc < 2){
+		cerr << "Usage: MyTaxaBench <db directory> [repeats]" << endl;
+		return 1;
+	}
+	string dbDir = string(argv[1]) + "/";
+	int repeats = (argc > 2)?atoi(argv[2]):3;
+	if(repeats < 1){
+		repeats = 1;
+	}
+
+	struct fileBench_st{
+		const char *name;
+		long (*legacy)(const char *);
+		long (*scan)(const char *);
+		long (*load)(const char *);
+	} benches[3] = {
+		{"ncbiNodes.lib", legacyNodes, scanNodes, loadNodes},
+		{"ncbiSciNames.lib", legacyNames, scanNames, loadNames},
+		{"geneTaxon.lib", legacyGeneTaxon, scanGeneTaxon, loadGeneTaxon}
+	};
+
+	for(int index = 0; index < 3; index++){
+		string path = dbDir + benches[index].name;
+		long numLines = benches[index].scan(path.c_str());
+		cout << benches[index].name << ": " << numLines << " lines" << endl;
+		report("legacy", benches[index].legacy, path.c_str(), numLines, repeats);
+		report("scanner", benches[index].scan, path.c_str(), numLines, repeats);
+		report("loader", benches[index].load, path.c_str(), numLines, repeats);
+	}
+	reportKernels(repeats);
+	return 0;
+}
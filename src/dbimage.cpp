@@ -0,0 +1,566 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dbimage.h"
+#include "textscan.h"
+#include "instream.h"
+#include "utility.h"
+#include "globals.h"
+#include "algo.h"
+#include "taxonomy.h"
+
+using namespace std;
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define SECTION_ALIGN 64
+
+static const char *sourceNames[DB_NUM_SOURCES] = {
+	"ncbiNodes.lib", "ncbiSciNames.lib", "geneTaxon.lib", "geneInfo.lib"
+};
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len){
+	const unsigned char *p = (const unsigned char *) data;
+	for(size_t i = 0; i < len; i++){
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t headerChecksum(const DBImageHeader *header){
+	return fnv1a(FNV_OFFSET, header, offsetof(DBImageHeader, headerChecksum));
+}
+
+////////////////////////// IMAGE WRITER ////////////////////////
+
+// sequential writer that keeps the running payload checksum;
+struct imageWriter_st {
+	FILE *fp;
+	string tmpPath;     // removed if the image cannot be written
+	uint64_t pos;
+	uint64_t checksum;
+	DBImageHeader header;
+};
+
+// give up on the image, leaving no partial file behind;
+static void abandonImage(imageWriter_st *w, const char *message){
+	cerr << message << ": " << w->tmpPath << endl;
+	fclose(w->fp);
+	unlink(w->tmpPath.c_str());
+	exit(EXIT_FAILURE);
+}
+
+static void writeBytes(imageWriter_st *w, const void *data, size_t len){
+	if(len == 0){
+		return;
+	}
+	if(fwrite(data, 1, len, w->fp) != len){
+		abandonImage(w, "Could not write database image");
+	}
+	w->checksum = fnv1a(w->checksum, data, len);
+	w->pos += len;
+}
+
+static void alignWriter(imageWriter_st *w){
+	static const char zeros[SECTION_ALIGN] = {0};
+	size_t pad = (SECTION_ALIGN - w->pos % SECTION_ALIGN) % SECTION_ALIGN;
+	writeBytes(w, zeros, pad);
+}
+
+static void beginSection(imageWriter_st *w, uint32_t id){
+	if(w->header.numSections == DB_MAX_SECTIONS){
+		abandonImage(w, "Too many sections in database image");
+	}
+	alignWriter(w);
+	dbSection_st *section = &w->header.sections[w->header.numSections++];
+	section->id = id;
+	section->offset = w->pos;
+	section->size = 0;
+}
+
+static void endSection(imageWriter_st *w){
+	dbSection_st *section = &w->header.sections[w->header.numSections - 1];
+	section->size = w->pos - section->offset;
+}
+
+static LineReader *openSource(const string &dbPath, int source, dbSource_st *info){
+	string path = findInputFile(dbPath + sourceNames[source]);
+	LineReader *reader = openLineReader(path.c_str());
+	struct stat st;
+	if(fstat(inputStreamFd(reader->stream), &st) != 0){
+		cerr << "Could not open database file: " << path << endl;
+		exit(EXIT_FAILURE);
+	}
+	info->size = st.st_size;
+	info->mtime = st.st_mtime;
+	return reader;
+}
+
+////////////////////////// SECTION BUILDERS ////////////////////////
+
+// ncbiNodes.lib, as the dense arrays, lineage table and rank table of a loaded TaxonTree;
+static void buildTreeSections(imageWriter_st *w, LineReader *reader){
+	TaxonTree *tTree = importTaxonTreeFromReader(reader);
+	uint64_t numTaxa = (tTree->parent == NULL)?0:(uint64_t) tTree->maxTaxonID + 1;
+
+	beginSection(w, DB_SECT_TREE);
+	writeBytes(w, tTree->parent, numTaxa * sizeof(IDnum));
+	endSection(w);
+
+	beginSection(w, DB_SECT_TREE_RANKS);
+	writeBytes(w, tTree->rank, numTaxa * sizeof(RankCode));
+	endSection(w);
+
+	beginSection(w, DB_SECT_TREE_LINEAGE);
+	writeBytes(w, tTree->lineage, numTaxa * sizeof(TaxonLineage));
+	endSection(w);
+
+	beginSection(w, DB_SECT_RANKS);
+	for(int code = 0; code < tTree->numRanks; code++){
+		writeBytes(w, tTree->rankNames[code], strlen(tTree->rankNames[code]) + 1);
+	}
+	endSection(w);
+
+	destroyTaxonTree(tTree);
+}
+
+// ncbiSciNames.lib, as the offset table and arena of a loaded TaxonName;
+static void buildNameSections(imageWriter_st *w, LineReader *reader){
+	TaxonName *tName = importTaxonNameFromReader(reader);
+
+	beginSection(w, DB_SECT_NAMES);
+	writeBytes(w, tName->offsets, (tName->maxTaxonID + 1) * sizeof(uint32_t));
+	endSection(w);
+
+	beginSection(w, DB_SECT_NAME_POOL);
+	writeBytes(w, tName->arena, tName->arenaSize);
+	endSection(w);
+
+	destroyTaxonName(tName);
+}
+
+static bool pairKeyLess(const dbPair_st &a, const dbPair_st &b){
+	return a.key < b.key;
+}
+
+// write pairs as sorted key and value sections plus a fence section; of
+// duplicate keys the one listed last in the source wins, as in the text loaders;
+static void writePairIndex(imageWriter_st *w, vector<dbPair_st> &pairs,
+								uint32_t keySection, uint32_t valueSection, uint32_t fenceSection){
+	stable_sort(pairs.begin(), pairs.end(), pairKeyLess);
+	
+	uint64_t numUnique = 0;
+	for(uint64_t i = 0; i < pairs.size(); i++){
+		if(i + 1 < pairs.size() && pairs[i+1].key == pairs[i].key){
+			continue;
+		}
+		pairs[numUnique++] = pairs[i];
+	}
+	pairs.resize(numUnique);
+	
+	vector<RefID> keys(pairs.size());
+	vector<IDnum> values(pairs.size());
+	vector<RefID> fences;
+	for(uint64_t i = 0; i < pairs.size(); i++){
+		keys[i] = pairs[i].key;
+		values[i] = pairs[i].value;
+		if(i % DB_INDEX_BLOCK == 0){
+			fences.push_back(pairs[i].key);
+		}
+	}
+	
+	beginSection(w, keySection);
+	writeBytes(w, keys.data(), keys.size() * sizeof(RefID));
+	endSection(w);
+	
+	beginSection(w, valueSection);
+	writeBytes(w, values.data(), values.size() * sizeof(IDnum));
+	endSection(w);
+	
+	beginSection(w, fenceSection);
+	writeBytes(w, fences.data(), fences.size() * sizeof(RefID));
+	endSection(w);
+}
+
+// geneTaxon.lib: <GI> <taxonID>
+static void buildGI2TaxonSection(imageWriter_st *w, LineReader *reader){
+	const char *line;
+	size_t length;
+	vector<dbPair_st> pairs;
+
+	while(readLine(reader, &line, &length)){
+		long GI, taxonID;
+		const char *p = parseIntField(line, line + length, &GI);
+		if(p == NULL || parseIntField(p, line + length, &taxonID) == NULL){
+			continue;
+		}
+		dbPair_st pair;
+		pair.key = GI;
+		pair.value = taxonID;
+		pairs.push_back(pair);
+	}
+	
+	writePairIndex(w, pairs, DB_SECT_GI2TAXON, DB_SECT_GI2TAXON_VALUES, DB_SECT_GI2TAXON_INDEX);
+}
+
+static bool clusterOffsetLess(const dbClusterOffset_st &a, const dbClusterOffset_st &b){
+	return a.clusterID < b.clusterID;
+}
+
+// geneInfo.lib: one record per cluster, made of a "<clusterID> <size>" line,
+// the member GIs ten per line, three dual histogram lines and one line of
+// substitution matrix parameters. The members go to a GI->clusterID table,
+// the parameters to a cluster record reachable through the offset index;
+static void buildClusterSections(imageWriter_st *w, LineReader *reader){
+	const char *line;
+	size_t length;
+	vector<dbPair_st> gi2clstr;
+	vector<dbClusterOffset_st> offsets;
+	vector<float> hist[3];
+	vector<float> subMTX;
+
+	beginSection(w, DB_SECT_CLUSTERS);
+	uint64_t sectionStart = w->pos;
+	while(readLine(reader, &line, &length)){
+		long clstrID, clstrSize;
+		const char *p = parseIntField(line, line + length, &clstrID);
+		if(p == NULL || parseIntField(p, line + length, &clstrSize) == NULL){
+			continue;
+		}
+		int numLines = clstrSize/10;
+		if(clstrSize%10 != 0){
+			numLines++;
+		}
+
+		for(int lineNum = 0; lineNum < numLines && readLine(reader, &line, &length); lineNum++){
+			const char *end = line + length;
+			for(const char *field = line; field <= end; ){
+				const char *fieldEnd = (const char *) memchr(field, '\t', end - field);
+				if(fieldEnd == NULL){
+					fieldEnd = end;
+				}
+				long GI;
+				if(parseIntField(field, fieldEnd, &GI) != NULL && GI != 0){
+					dbPair_st pair;
+					pair.key = GI;
+					pair.value = clstrID;
+					gi2clstr.push_back(pair);
+				}
+				field = fieldEnd + 1;
+			}
+		}
+
+		unsigned int numBins = 0;
+		for(int rank = 0; rank < 3; rank++){
+			hist[rank].clear();
+			if(!readLine(reader, &line, &length)){
+				break;
+			}
+			parseTabFloats(line, line + length, hist[rank]);
+			if(hist[rank].size() > numBins){
+				numBins = hist[rank].size();
+			}
+		}
+		// ragged histograms are padded with the out-of-range default;
+		for(int rank = 0; rank < 3; rank++){
+			hist[rank].resize(numBins, 1.0);
+		}
+
+		subMTX.clear();
+		if(readLine(reader, &line, &length)){
+			parseTabFloats(line, line + length, subMTX);
+		}
+		subMTX.resize(3, -1.0);
+
+		dbClusterOffset_st offset;
+		offset.clusterID = clstrID;
+		offset.reserved = 0;
+		offset.offset = w->pos - sectionStart;
+		offsets.push_back(offset);
+
+		DBClusterRecord record;
+		record.clusterID = clstrID;
+		record.numBins = numBins;
+		writeBytes(w, &record, sizeof(record));
+		for(int rank = 0; rank < 3; rank++){
+			writeBytes(w, hist[rank].data(), numBins * sizeof(float));
+		}
+		writeBytes(w, subMTX.data(), 3 * sizeof(float));
+	}
+	endSection(w);
+
+	// a GI listed in several clusters belongs to the last one, as in the text loader;
+	writePairIndex(w, gi2clstr, DB_SECT_GI2CLUSTER, DB_SECT_GI2CLUSTER_VALUES, DB_SECT_GI2CLUSTER_INDEX);
+
+	// of repeated cluster IDs the first record is used, as in the text loader;
+	stable_sort(offsets.begin(), offsets.end(), clusterOffsetLess);
+	uint64_t numUnique = 0;
+	for(uint64_t i = 0; i < offsets.size(); i++){
+		if(numUnique > 0 && offsets[numUnique-1].clusterID == offsets[i].clusterID){
+			continue;
+		}
+		offsets[numUnique++] = offsets[i];
+	}
+	offsets.resize(numUnique);
+
+	beginSection(w, DB_SECT_CLUSTER_OFFSETS);
+	writeBytes(w, offsets.data(), offsets.size() * sizeof(dbClusterOffset_st));
+	endSection(w);
+}
+
+int buildDBImage(const char *dbDir){
+	string dbPath = string(dbDir);
+	if(dbPath.empty() || dbPath[dbPath.size()-1] != '/'){
+		dbPath += "/";
+	}
+	string imagePath = dbPath + DB_IMAGE_NAME;
+	char pidString[32];
+	sprintf(pidString, ".%d", (int) getpid());
+	string tmpPath = imagePath + pidString;
+
+	// the readers exit on missing files, so check them before creating tmpPath;
+	for(int source = 0; source < DB_NUM_SOURCES; source++){
+		string path = findInputFile(dbPath + sourceNames[source]);
+		if(access(path.c_str(), R_OK) != 0){
+			cerr << "Could not open database file: " << path << endl;
+			return 1;
+		}
+	}
+
+	imageWriter_st w;
+	memset(&w.header, 0, sizeof(DBImageHeader));
+	w.tmpPath = tmpPath;
+	w.fp = fopen(tmpPath.c_str(), "wb");
+	if(w.fp == NULL){
+		cerr << "Could not create database image: " << tmpPath << endl;
+		return 1;
+	}
+	// header placeholder, rewritten once all sections are known;
+	if(fwrite(&w.header, sizeof(DBImageHeader), 1, w.fp) != 1){
+		abandonImage(&w, "Could not write database image");
+	}
+	w.pos = sizeof(DBImageHeader);
+	w.checksum = FNV_OFFSET;
+
+	LineReader *reader;
+	cout << "Compiling " << sourceNames[DB_SRC_NODES] << "..." << endl;
+	reader = openSource(dbPath, DB_SRC_NODES, &w.header.sources[DB_SRC_NODES]);
+	buildTreeSections(&w, reader);
+	closeLineReader(reader);
+
+	cout << "Compiling " << sourceNames[DB_SRC_NAMES] << "..." << endl;
+	reader = openSource(dbPath, DB_SRC_NAMES, &w.header.sources[DB_SRC_NAMES]);
+	buildNameSections(&w, reader);
+	closeLineReader(reader);
+
+	cout << "Compiling " << sourceNames[DB_SRC_GENE_TAXON] << "..." << endl;
+	reader = openSource(dbPath, DB_SRC_GENE_TAXON, &w.header.sources[DB_SRC_GENE_TAXON]);
+	buildGI2TaxonSection(&w, reader);
+	closeLineReader(reader);
+
+	cout << "Compiling " << sourceNames[DB_SRC_GENE_INFO] << "..." << endl;
+	reader = openSource(dbPath, DB_SRC_GENE_INFO, &w.header.sources[DB_SRC_GENE_INFO]);
+	buildClusterSections(&w, reader);
+	closeLineReader(reader);
+
+	alignWriter(&w);
+	memcpy(w.header.magic, DB_IMAGE_MAGIC, 8);
+	w.header.version = DB_IMAGE_VERSION;
+	w.header.fileSize = w.pos;
+	w.header.payloadChecksum = w.checksum;
+	w.header.headerChecksum = headerChecksum(&w.header);
+
+	if(fseek(w.fp, 0, SEEK_SET) != 0 || fwrite(&w.header, sizeof(DBImageHeader), 1, w.fp) != 1
+		|| fclose(w.fp) != 0){
+		cerr << "Could not write database image: " << tmpPath << endl;
+		unlink(tmpPath.c_str());
+		return 1;
+	}
+
+	// atomic replace, so running processes keep their mapping of the old image;
+	if(rename(tmpPath.c_str(), imagePath.c_str()) != 0){
+		cerr << "Could not install database image: " << imagePath << endl;
+		unlink(tmpPath.c_str());
+		return 1;
+	}
+
+	cout << "Database image written to " << imagePath << " (" << w.pos << " bytes)" << endl;
+	return 0;
+}
+
+////////////////////////// IMAGE READER ////////////////////////
+
+DBImage *openDBImage(const char *imageFile, const char *sourceFiles[DB_NUM_SOURCES]){
+	int fd = open(imageFile, O_RDONLY);
+	if(fd < 0){
+		return NULL;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(DBImageHeader)){
+		close(fd);
+		cerr << "Ignoring truncated database image: " << imageFile << endl;
+		return NULL;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(base == MAP_FAILED){
+		close(fd);
+		cerr << "Could not map database image: " << imageFile << endl;
+		return NULL;
+	}
+
+	const DBImageHeader *header = (const DBImageHeader *) base;
+	const char *problem = NULL;
+	if(memcmp(header->magic, DB_IMAGE_MAGIC, 8) != 0){
+		problem = "not a MyTaxa database image";
+	}else if(header->version != DB_IMAGE_VERSION){
+		problem = "built by another MyTaxa version, please run MyTaxa build-db";
+	}else if(header->headerChecksum != headerChecksum(header)
+				|| header->fileSize != (uint64_t) st.st_size
+				|| header->numSections > DB_MAX_SECTIONS){
+		problem = "corrupt header";
+	}
+
+	for(uint32_t i = 0; problem == NULL && i < header->numSections; i++){
+		if(header->sections[i].offset + header->sections[i].size > header->fileSize){
+			problem = "corrupt section table";
+		}
+	}
+
+	// an image is only as fresh as the text libraries it was compiled from;
+	for(int i = 0; problem == NULL && i < DB_NUM_SOURCES; i++){
+		struct stat srcSt;
+		if(sourceFiles[i] == NULL || stat(sourceFiles[i], &srcSt) != 0){
+			continue;
+		}
+		if((uint64_t) srcSt.st_size != header->sources[i].size || srcSt.st_mtime != header->sources[i].mtime){
+			problem = "older than the text libraries, please run MyTaxa build-db";
+		}
+	}
+
+	if(problem != NULL){
+		cerr << "Ignoring database image " << imageFile << ": " << problem << endl;
+		munmap(base, st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	DBImage *image = callocOrExit(1, DBImage);
+	image->fd = fd;
+	image->base = (const char *) base;
+	image->size = st.st_size;
+	image->header = header;
+	return image;
+}
+
+bool verifyDBImage(DBImage *image){
+	uint64_t checksum = fnv1a(FNV_OFFSET, image->base + sizeof(DBImageHeader),
+								image->size - sizeof(DBImageHeader));
+	return checksum == image->header->payloadChecksum;
+}
+
+void closeDBImage(DBImage *image){
+	if(image == NULL){
+		return;
+	}
+	munmap((void *) image->base, image->size);
+	close(image->fd);
+	free(image);
+}
+
+const void *dbImageSection(DBImage *image, uint32_t id, uint64_t *size){
+	for(uint32_t i = 0; i < image->header->numSections; i++){
+		if(image->header->sections[i].id == id){
+			*size = image->header->sections[i].size;
+			return image->base + image->header->sections[i].offset;
+		}
+	}
+	*size = 0;
+	return NULL;
+}
+
+size_t dbClusterRecordSize(const DBClusterRecord *record){
+	return sizeof(DBClusterRecord) + (3 * record->numBins + 3) * sizeof(float);
+}
+
+void dbOpenPairIndex(DBImage *image, uint32_t keySection, uint32_t valueSection, uint32_t fenceSection, DBPairIndex *index){
+	uint64_t size;
+	index->keys = (const RefID *) dbImageSection(image, keySection, &size);
+	index->numPairs = size / sizeof(RefID);
+	index->values = (const IDnum *) dbImageSection(image, valueSection, &size);
+	if(size / sizeof(IDnum) < index->numPairs){
+		index->numPairs = size / sizeof(IDnum);
+	}
+	index->fences = (const RefID *) dbImageSection(image, fenceSection, &size);
+	index->numBlocks = size / sizeof(RefID);
+}
+
+// plain binary searches: readers with taxon lists look up every input line;
+bool dbLookupPairIndex(const DBPairIndex *index, RefID key, IDnum *value){
+	// last block whose first key is <= key;
+	uint64_t low = 0, high = index->numBlocks;
+	while(low < high){
+		uint64_t middle = (low + high) / 2;
+		if(index->fences[middle] <= key){
+			low = middle + 1;
+		}else{
+			high = middle;
+		}
+	}
+	if(low == 0){
+		return false;
+	}
+	uint64_t block = low - 1;
+	
+	// first key >= key in the block;
+	low = block * DB_INDEX_BLOCK;
+	high = min(index->numPairs, (block + 1) * DB_INDEX_BLOCK);
+	uint64_t end = high;
+	while(low < high){
+		uint64_t middle = (low + high) / 2;
+		if(index->keys[middle] < key){
+			low = middle + 1;
+		}else{
+			high = middle;
+		}
+	}
+	if(low == end || index->keys[low] != key){
+		return false;
+	}
+	*value = index->values[low];
+	return true;
+}
+
+const DBClusterRecord *dbFindClusterRecord(DBImage *image, IDnum clusterID){
+	uint64_t size, clustersSize;
+	const dbClusterOffset_st *offsets = (const dbClusterOffset_st *) dbImageSection(image, DB_SECT_CLUSTER_OFFSETS, &size);
+	const char *clusters = (const char *) dbImageSection(image, DB_SECT_CLUSTERS, &clustersSize);
+	const dbClusterOffset_st *last = offsets + size / sizeof(dbClusterOffset_st);
+	
+	dbClusterOffset_st probe;
+	probe.clusterID = clusterID;
+	const dbClusterOffset_st *it = lower_bound(offsets, last, probe, clusterOffsetLess);
+	if(it == last || it->clusterID != clusterID){
+		return NULL;
+	}
+	return (const DBClusterRecord *) (clusters + it->offset);
+}
@@ -0,0 +1,140 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#ifndef _DBIMAGE_H_
+#define _DBIMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "globals.h"
+
+// The compiled database image (db/MyTaxa.db) holds the four text libraries
+// in a parse-free binary form. It is built once by "MyTaxa build-db" and
+// mapped read-only by every run, so concurrent processes share its pages.
+//
+// Layout: a fixed-size header, followed by 64-byte aligned sections that
+// are listed in the header's section table.
+
+#define DB_IMAGE_NAME "MyTaxa.db"
+#define DB_IMAGE_MAGIC "MYTAXADB"
+#define DB_IMAGE_VERSION 7
+#define DB_MAX_SECTIONS 16
+#define DB_NUM_SOURCES 4
+
+// section IDs
+#define DB_SECT_TREE 1         // IDnum parent[maxTaxonID+1] of TaxonTree
+#define DB_SECT_RANKS 2        // NUL-terminated rank names, in RankCode order
+#define DB_SECT_NAMES 3        // uint32_t offsets[maxTaxonID+1] of TaxonName
+#define DB_SECT_NAME_POOL 4    // NUL-terminated scientific names, the TaxonName arena
+#define DB_SECT_GI2TAXON 5     // RefID GIs of the GI->taxonID table, sorted
+#define DB_SECT_CLUSTERS 6     // dbClusterRecord_st stream, in geneInfo.lib order
+#define DB_SECT_GI2TAXON_INDEX 7   // first GI of every DB_INDEX_BLOCK pairs of DB_SECT_GI2TAXON
+#define DB_SECT_GI2CLUSTER 8   // RefID GIs of the GI->clusterID table, sorted
+#define DB_SECT_GI2CLUSTER_INDEX 9 // first GI of every DB_INDEX_BLOCK pairs of DB_SECT_GI2CLUSTER
+#define DB_SECT_CLUSTER_OFFSETS 10 // dbClusterOffset_st[], sorted by clusterID
+#define DB_SECT_TREE_RANKS 11  // RankCode rank[maxTaxonID+1] of TaxonTree
+#define DB_SECT_TREE_LINEAGE 12    // TaxonLineage lineage[maxTaxonID+1] of TaxonTree
+#define DB_SECT_GI2TAXON_VALUES 13 // IDnum taxonIDs, in DB_SECT_GI2TAXON order
+#define DB_SECT_GI2CLUSTER_VALUES 14   // IDnum clusterIDs, in DB_SECT_GI2CLUSTER order
+
+// keys per block of a sorted pair table, one 4KB page;
+#define DB_INDEX_BLOCK 512
+
+// the text libraries an image is compiled from, in dbImageHeader_st.sources order
+#define DB_SRC_NODES 0
+#define DB_SRC_NAMES 1
+#define DB_SRC_GENE_TAXON 2
+#define DB_SRC_GENE_INFO 3
+
+struct dbSection_st {
+	uint32_t id;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct dbSource_st {
+	uint64_t size;
+	int64_t mtime;
+};
+
+struct dbImageHeader_st {
+	char magic[8];
+	uint32_t version;
+	uint32_t numSections;
+	uint64_t fileSize;
+	uint64_t payloadChecksum;   // FNV-1a over everything after the header
+	dbSource_st sources[DB_NUM_SOURCES];
+	dbSection_st sections[DB_MAX_SECTIONS];
+	uint64_t headerChecksum;    // FNV-1a over all the fields above
+};
+
+// sorted key->value tables are stored as a key section and a value section,
+// 12 bytes a pair without padding, with one key per DB_INDEX_BLOCK pairs in a
+// separate fence section so a lookup touches the fences, a single block of
+// keys and one value; dbPair_st is the form they are built from;
+struct dbPair_st {
+	RefID key;
+	IDnum value;
+};
+
+// followed by 3*numBins floats of phylum/genus/species dual histograms and
+// 3 floats of the substitution matrix parameters; the member GIs of the
+// cluster are in DB_SECT_GI2CLUSTER;
+struct dbClusterRecord_st {
+	IDnum clusterID;
+	uint32_t numBins;
+};
+
+struct dbClusterOffset_st {
+	IDnum clusterID;
+	uint32_t reserved;
+	uint64_t offset;            // into DB_SECT_CLUSTERS
+};
+
+struct dbPairIndex_st {
+	const RefID *keys;
+	const IDnum *values;
+	uint64_t numPairs;
+	const RefID *fences;
+	uint64_t numBlocks;
+};
+
+struct dbImage_st {
+	int fd;
+	const char *base;
+	size_t size;
+	const DBImageHeader *header;
+};
+
+// compile the four text libraries in dbDir into dbDir/MyTaxa.db;
+// returns 0 on success;
+int buildDBImage(const char *dbDir);
+
+// full payload verification, reads the whole image;
+bool verifyDBImage(DBImage *image);
+
+// map an image read-only; returns NULL if it is missing, corrupt, of another
+// version, or older than one of the text libraries it was built from;
+DBImage *openDBImage(const char *imageFile, const char *sourceFiles[DB_NUM_SOURCES]);
+
+void closeDBImage(DBImage *image);
+
+const void *dbImageSection(DBImage *image, uint32_t id, uint64_t *size);
+
+size_t dbClusterRecordSize(const DBClusterRecord *record);
+
+// attach to the key, value and fence sections of a sorted pair table;
+void dbOpenPairIndex(DBImage *image, uint32_t keySection, uint32_t valueSection, uint32_t fenceSection, DBPairIndex *index);
+
+// returns true and sets value if key is in the table;
+bool dbLookupPairIndex(const DBPairIndex *index, RefID key, IDnum *value);
+
+// seek a cluster record by ID through DB_SECT_CLUSTER_OFFSETS, NULL if absent;
+const DBClusterRecord *dbFindClusterRecord(DBImage *image, IDnum clusterID);
+
+#endif
@@ -27,7 +27,7 @@
 #define RELEASE_NUMBER 0
 #define UPDATE_NUMBER 0
 
-// weights
+// default weights, see scoreWeights_st in algo.h
 #define W10  1
 #define W11  1
 #define W12  1
@@ -35,11 +35,14 @@
 #define W21  1
 #define W22  1
 
-// bitscore drop thr
+// default bitscore drop thr
 #define SCORE_DROP_THR 0.1
 
+// default identity (%) and bitscore below which input hits are dropped
+#define MIN_IDENTITY 40
+#define MIN_BITSCORE 50
+
 // external structures here
-struct taxonNode_st;
 struct taxonTree_st;
 struct taxonName_st;
 struct nameRank_st;
@@ -47,16 +50,42 @@ struct nameRank_st;
 // Namespace sizes here
 #include <stdint.h>
 typedef int32_t IDnum;
+typedef int64_t RefID;     // reference protein (GI) numbers, past 2^31
+typedef uint8_t RankCode;
 #endif
 
 // Taxonomy elements
-typedef struct taxonNode_st TaxonNode;
 typedef struct taxonTree_st TaxonTree;
 typedef struct taxonName_st TaxonName;
 typedef struct nameRank_st NameRank;
 typedef struct IDRank_st IDRank;
+typedef struct taxonLineage_st TaxonLineage;
+typedef struct lcaIndex_st LCAIndex;
+typedef struct taxonInterval_st TaxonInterval;
 
 // algo elements
 typedef struct sequence_st Sequence;
-typedef struct gene_st Gene;
-typedef struct pathNode_st PathNode;
\ No newline at end of file
+typedef struct queryBatch_st QueryBatch;
+typedef struct clusterPara_st ClusterPara;
+typedef struct assignment_st Assignment;
+typedef struct queryReader_st QueryReader;
+typedef struct geneTables_st GeneTables;
+typedef struct geneLocus_st GeneLocus;
+typedef struct inputFormat_st InputFormat;
+typedef struct hitFilter_st HitFilter;
+typedef struct hitSelector_st HitSelector;
+typedef struct scoreWeights_st ScoreWeights;
+typedef struct scoreAccumulator_st ScoreAccumulator;
+typedef struct scoreKernels_st ScoreKernels;
+
+// database image elements
+typedef struct dbImage_st DBImage;
+typedef struct dbImageHeader_st DBImageHeader;
+typedef struct dbClusterRecord_st DBClusterRecord;
+typedef struct dbPairIndex_st DBPairIndex;
+
+// text scanning elements
+typedef struct mappedFile_st MappedFile;
+typedef struct lineReader_st LineReader;
+typedef struct textField_st TextField;
+typedef struct inputStream_st InputStream;
@@ -0,0 +1,369 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "instream.h"
+#include "globals.h"
+
+using namespace std;
+
+#define DECODE_BLOCK (1 << 20)      // bytes of decoded data per queued block
+#define DECODE_QUEUE 4              // blocks decoded ahead of the reader
+#define COMPRESSED_READ (1 << 18)   // bytes of compressed data read at once
+
+struct inputStream_st {
+	int fd;
+	int format;
+
+	// the bytes read to detect the format, returned before the rest of fd;
+	char prefix[4];
+	size_t prefixSize;
+	size_t prefixPos;
+
+	// decoded blocks, filled by the decoder thread and drained by the reader;
+	thread decoder;
+	mutex lock;
+	condition_variable changed;
+	deque<vector<char> > blocks;
+	vector<char> current;
+	size_t currentPos;
+	bool finished;      // the decoder has queued its last block
+	bool closing;       // the reader has stopped reading
+	string error;       // of the decoder
+	
+	bool exitOnError;   // else errors end the input and are kept in failure
+	string failure;
+};
+
+// the undecoded bytes of the input, 0 at its end or with the reason in
+// error if it cannot be read;
+static size_t readRaw(InputStream *stream, char *buffer, size_t size, string &error){
+	if(stream->prefixPos < stream->prefixSize){
+		size_t numRead = stream->prefixSize - stream->prefixPos;
+		if(numRead > size){
+			numRead = size;
+		}
+		memcpy(buffer, stream->prefix + stream->prefixPos, numRead);
+		stream->prefixPos += numRead;
+		return numRead;
+	}
+	while(true){
+		ssize_t numRead = read(stream->fd, buffer, size);
+		if(numRead >= 0){
+			return numRead;
+		}
+		if(errno != EINTR){
+			error = string("Could not read input: ") + strerror(errno);
+			return 0;
+		}
+	}
+}
+
+////////////////////////// DECODER THREAD ////////////////////////
+
+// queue a full block, waiting while the queue is full; false once the
+// reader has closed the stream;
+static bool queueBlock(InputStream *stream, vector<char> &block){
+	unique_lock<mutex> guard(stream->lock);
+	while(stream->blocks.size() >= DECODE_QUEUE && !stream->closing){
+		stream->changed.wait(guard);
+	}
+	if(stream->closing){
+		return false;
+	}
+	stream->blocks.push_back(vector<char>());
+	stream->blocks.back().swap(block);
+	stream->changed.notify_all();
+	return true;
+}
+
+static void finishDecoding(InputStream *stream, const string &error){
+	lock_guard<mutex> guard(stream->lock);
+	stream->finished = true;
+	stream->error = error;
+	stream->changed.notify_all();
+}
+
+// gzip, including files of several concatenated members;
+static void gunzipInput(InputStream *stream){
+	vector<char> in(COMPRESSED_READ);
+	vector<char> out(DECODE_BLOCK);
+	size_t outSize = 0;
+	string error;
+	bool inputEnd = false;
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if(inflateInit2(&z, 15 + 32) != Z_OK){
+		finishDecoding(stream, "Could not initialise gzip decoding");
+		return;
+	}
+	int ret = Z_OK;
+	while(true){
+		if(z.avail_in == 0 && !inputEnd){
+			z.avail_in = readRaw(stream, &in[0], in.size(), error);
+			z.next_in = (Bytef *) &in[0];
+			inputEnd = (z.avail_in == 0);
+			if(!error.empty()){
+				break;
+			}
+		}
+		if(z.avail_in == 0 && inputEnd){
+			if(ret != Z_STREAM_END){
+				error = "Truncated gzip input";
+			}
+			break;
+		}
+
+		z.next_out = (Bytef *) &out[outSize];
+		z.avail_out = out.size() - outSize;
+		ret = inflate(&z, Z_NO_FLUSH);
+		if(ret == Z_STREAM_END){
+			inflateReset(&z);
+		}else if(ret != Z_OK && ret != Z_BUF_ERROR){
+			error = "Corrupt gzip input";
+			break;
+		}
+		outSize = out.size() - z.avail_out;
+
+		if(outSize == out.size()){
+			if(!queueBlock(stream, out)){
+				break;
+			}
+			out.resize(DECODE_BLOCK);
+			outSize = 0;
+		}
+	}
+	inflateEnd(&z);
+
+	if(error.empty() && outSize > 0){
+		out.resize(outSize);
+		queueBlock(stream, out);
+	}
+	finishDecoding(stream, error);
+}
+
+#ifdef HAVE_ZSTD
+// zstd, including files of several concatenated frames;
+static void unzstdInput(InputStream *stream){
+	vector<char> in(COMPRESSED_READ);
+	vector<char> out(DECODE_BLOCK);
+	string error;
+
+	ZSTD_DStream *zds = ZSTD_createDStream();
+	ZSTD_initDStream(zds);
+	ZSTD_inBuffer input = {&in[0], 0, 0};
+	ZSTD_outBuffer output = {&out[0], out.size(), 0};
+	size_t ret = 0;
+	bool inputEnd = false;
+	while(true){
+		if(input.pos == input.size && !inputEnd){
+			input.size = readRaw(stream, &in[0], in.size(), error);
+			input.pos = 0;
+			inputEnd = (input.size == 0);
+			if(!error.empty()){
+				break;
+			}
+		}
+		// without more input, a frame is complete once its return value is 0;
+		if(inputEnd && ret == 0){
+			break;
+		}
+
+		size_t outStart = output.pos;
+		ret = ZSTD_decompressStream(zds, &output, &input);
+		if(ZSTD_isError(ret)){
+			error = string("Corrupt zstd input: ") + ZSTD_getErrorName(ret);
+			break;
+		}
+		// at the end of the input zstd may still hold decoded data that did
+		// not fit in out; the frame is cut short only if none comes out;
+		if(inputEnd && ret != 0 && output.pos == outStart){
+			error = "Truncated zstd input";
+			break;
+		}
+
+		if(output.pos == output.size){
+			if(!queueBlock(stream, out)){
+				break;
+			}
+			out.resize(DECODE_BLOCK);
+			output.dst = &out[0];
+			output.pos = 0;
+		}
+	}
+	ZSTD_freeDStream(zds);
+
+	if(error.empty() && output.pos > 0){
+		out.resize(output.pos);
+		queueBlock(stream, out);
+	}
+	finishDecoding(stream, error);
+}
+#endif
+
+////////////////////////// READER ////////////////////////
+
+// exit with the error, or hand it back through error;
+static InputStream *failOpen(const string &message, string *error){
+	if(error == NULL){
+		cerr << message << endl;
+		exit(EXIT_FAILURE);
+	}
+	*error = message;
+	return NULL;
+}
+
+// end the input of the reader with message;
+static size_t failRead(InputStream *stream, const string &message){
+	if(stream->exitOnError){
+		cerr << message << endl;
+		exit(EXIT_FAILURE);
+	}
+	if(stream->failure.empty()){
+		stream->failure = message;
+	}
+	return 0;
+}
+
+InputStream *openInputStream(const char *path, string *error){
+	bool isStdin = (path != NULL && strcmp(path, STDIN_PATH) == 0);
+	int fd = isStdin?STDIN_FILENO:((path == NULL)?-1:open(path, O_RDONLY));
+	if(fd < 0){
+		return failOpen(string("Could not open file: ") + ((path == NULL)?"(missing)":path), error);
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	InputStream *stream = new InputStream;
+	stream->fd = fd;
+	stream->format = INPUT_PLAIN;
+	stream->prefixSize = 0;
+	stream->prefixPos = 0;
+	stream->currentPos = 0;
+	stream->finished = false;
+	stream->closing = false;
+	stream->exitOnError = (error == NULL);
+
+	// pipes may return the magic bytes in pieces;
+	string readError;
+	while(stream->prefixSize < sizeof(stream->prefix)){
+		size_t numRead = readRaw(stream, stream->prefix + stream->prefixSize, sizeof(stream->prefix) - stream->prefixSize, readError);
+		if(numRead == 0){
+			break;
+		}
+		stream->prefixSize += numRead;
+	}
+	if(!readError.empty()){
+		closeInputStream(stream);
+		return failOpen(readError, error);
+	}
+
+	const unsigned char *magic = (const unsigned char *) stream->prefix;
+	if(stream->prefixSize >= 2 && magic[0] == 0x1f && magic[1] == 0x8b){
+		stream->format = INPUT_GZIP;
+		stream->decoder = thread(gunzipInput, stream);
+	}else if(stream->prefixSize >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd){
+		stream->format = INPUT_ZSTD;
+#ifdef HAVE_ZSTD
+		stream->decoder = thread(unzstdInput, stream);
+#else
+		closeInputStream(stream);
+		return failOpen(string("Input is zstd compressed, but MyTaxa was built without zstd support (make ZSTD=1): ") + path, error);
+#endif
+	}
+	return stream;
+}
+
+size_t readInputStream(InputStream *stream, char *buffer, size_t size){
+	if(!stream->failure.empty()){
+		return 0;
+	}
+	if(stream->format == INPUT_PLAIN){
+		string error;
+		size_t numRead = readRaw(stream, buffer, size, error);
+		return error.empty()?numRead:failRead(stream, error);
+	}
+
+	while(stream->currentPos == stream->current.size()){
+		unique_lock<mutex> guard(stream->lock);
+		while(stream->blocks.empty() && !stream->finished){
+			stream->changed.wait(guard);
+		}
+		if(stream->blocks.empty()){
+			return stream->error.empty()?0:failRead(stream, stream->error);
+		}
+		stream->current.swap(stream->blocks.front());
+		stream->blocks.pop_front();
+		stream->currentPos = 0;
+		stream->changed.notify_all();
+	}
+
+	size_t numRead = stream->current.size() - stream->currentPos;
+	if(numRead > size){
+		numRead = size;
+	}
+	memcpy(buffer, &stream->current[stream->currentPos], numRead);
+	stream->currentPos += numRead;
+	return numRead;
+}
+
+const string &inputStreamError(InputStream *stream){
+	return stream->failure;
+}
+
+int inputStreamFormat(InputStream *stream){
+	return stream->format;
+}
+
+int inputStreamFd(InputStream *stream){
+	return stream->fd;
+}
+
+void closeInputStream(InputStream *stream){
+	if(stream == NULL){
+		return;
+	}
+	if(stream->decoder.joinable()){
+		{
+			lock_guard<mutex> guard(stream->lock);
+			stream->closing = true;
+			stream->changed.notify_all();
+		}
+		stream->decoder.join();
+	}
+	if(stream->fd != STDIN_FILENO){
+		close(stream->fd);
+	}
+	delete stream;
+}
+
+string findInputFile(const string &path){
+	static const char *suffixes[3] = {"", ".gz", ".zst"};
+	for(int index = 0; index < 3; index++){
+		string candidate = path + suffixes[index];
+		if(access(candidate.c_str(), F_OK) == 0){
+			return candidate;
+		}
+	}
+	return path;
+}
@@ -0,0 +1,52 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#ifndef _INSTREAM_H_
+#define _INSTREAM_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include "globals.h"
+
+using namespace std;
+
+// Sequential input from a file or stdin ("-"). gzip and, when built with
+// HAVE_ZSTD, zstd data are recognised by their magic bytes and decoded by a
+// background thread that hands blocks to the reader through a bounded queue,
+// so decompression overlaps with parsing and nothing is written to disk.
+
+#define STDIN_PATH "-"
+
+#define INPUT_PLAIN 0
+#define INPUT_GZIP 1
+#define INPUT_ZSTD 2
+
+// exits with an error message if the input cannot be opened, or with a
+// NULL error later on read or decoding errors; otherwise returns NULL with
+// the message in *error, or ends the input early and keeps it for
+// inputStreamError(), so that a server can refuse one bad input and go on;
+InputStream *openInputStream(const char *path, string *error = NULL);
+
+// like read(2): up to size bytes, 0 at the end of the input;
+size_t readInputStream(InputStream *stream, char *buffer, size_t size);
+
+// the read or decoding error that ended the input, empty if none;
+const string &inputStreamError(InputStream *stream);
+
+// INPUT_PLAIN, INPUT_GZIP or INPUT_ZSTD;
+int inputStreamFormat(InputStream *stream);
+
+// the descriptor of the underlying file or stdin;
+int inputStreamFd(InputStream *stream);
+
+void closeInputStream(InputStream *stream);
+
+// path itself if it exists, else path.gz or path.zst if one of them does;
+string findInputFile(const string &path);
+
+#endif
@@ -10,7 +10,11 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstring>
 #include <sys/stat.h>
+#include <thread>
+#include <fstream>
+#include <iterator>
 
 #include "run.h"
 
@@ -25,11 +29,48 @@ void printUsage()
 	cout << "Version: " << VERSION_NUMBER << ".";
 	cout << RELEASE_NUMBER << "." << UPDATE_NUMBER << endl;
 	cout << "Usage:" << endl;
-	cout << "MeTaxa <input file> <output file> <score cutoff>";
+	cout << "MeTaxa [--threads N] [--stream] [--genes FILE] <input file> <output file> <score cutoff> [num hits]" << endl;
+	cout << "MeTaxa build-db [db directory]     compile the db/*.lib files into db/" << DB_IMAGE_NAME << endl;
+	cout << "MeTaxa check-db                    verify the checksum of db/" << DB_IMAGE_NAME << endl;
+	cout << "MeTaxa batch [--threads N] [--genes FILE] <manifest file> <score cutoff>" << endl;
+	cout << "                                   classify every \"<input file>\\t<output file>\" line of the manifest" << endl;
+	cout << "MeTaxa serve [--socket PATH] [--threads N] [--params FILE]" << endl;
+	cout << "                                   keep the database loaded and classify jobs sent by clients" << endl;
+	cout << "MeTaxa client [--socket PATH] <input file> <output file> <score cutoff> [num hits]" << endl;
+	cout << "                                   classify on a running server" << endl;
 	cout << "## [Format of input file]:" << endl;
+	cout << "\tAn input file of \"-\" is read from stdin; gzip";
+#ifdef HAVE_ZSTD
+	cout << " and zstd";
+#endif
+	cout << " compressed input and db files are decompressed on the fly." << endl;
 	cout << "\tBased on blast -m 8 output format, for each blast-like output line," << endl;
 	cout << "\tadd additional 3 tab delimited columns to each line:" << endl;
 	cout << "\t[Query sequence name] [Gene name] [protein GI number]" << endl;
+	cout << "\tWith --genes, the input is the plain 12-column tabular output of BLAST or DIAMOND" << endl;
+	cout << "\tagainst the gi|<GI>|... protein database, and the gene prediction file maps every" << endl;
+	cout << "\tgene (query) to its contig, as utils/infile_convert.pl used to." << endl;
+	cout << "## [Options]:" << endl;
+	cout << "\t--threads N\tthreads scanning the text libraries and scoring the queries (default: all cores)" << endl;
+	cout << "\t\t\tfor serve, the jobs run at once, each on one thread" << endl;
+	cout << "\t--stream\tread, score and write the input " << STREAM_WINDOW << " query sequences at a time" << endl;
+	cout << "\t--socket PATH\tsocket of serve and client (default: db/" << SERVE_SOCKET_NAME << ")" << endl;
+	cout << "\t--genes FILE\tgene predictions of the contigs for tabular search input" << endl;
+	cout << "\t--genes-format F\tgff2 (default), gff3, tab (gene, length in nt, contig), or no" << endl;
+	cout << "\t\t\t(tabular input without contigs: each gene is classified alone)" << endl;
+	cout << "\t--min-aligned-fraction F\tfraction of the gene length a hit must align (default: 0.75)" << endl;
+	cout << "\t--max-hits-per-gene N\tbest scoring hits kept per gene, like [num hits] (default: 0, all)" << endl;
+	cout << "\t--mode M\tlikelihood (default), or lca: the lowest common ancestor of the taxa of the hits," << endl;
+	cout << "\t\t\twith the fraction of hits of known taxa as score" << endl;
+	cout << "\t--include-taxa ID,...\tonly use the hits to these NCBI taxa and their descendants" << endl;
+	cout << "\t--exclude-taxa ID,...\tignore the hits to these NCBI taxa and their descendants" << endl;
+	cout << "\t--params FILE\tscoring parameters, \"<name> <value>\" lines of W10, W11, W12, W20, W21, W22," << endl;
+	cout << "\t\t\tSCORE_DROP_THR, MIN_IDENTITY and MIN_BITSCORE; later options override it" << endl;
+	cout << "\t--weights W10,W11,W12,W20,W21,W22\tdual histogram and subMTX weights of phylum, genus, species (default: all 1)" << endl;
+	cout << "\t--score-drop F\trelative bitscore drop between hits of a gene that drops the lowest (default: " << SCORE_DROP_THR << ")" << endl;
+	cout << "\t--min-identity F\tidentity (%) below which hits are ignored (default: " << MIN_IDENTITY << ")" << endl;
+	cout << "\t--min-bitscore F\tbitscore below which hits are ignored (default: " << MIN_BITSCORE << ")" << endl;
+	cout << "\t\t\tserve applies its scoring options to all the jobs it runs" << endl;
 	cout << "#############################################################################################" << endl;
 }
 
@@ -46,25 +87,251 @@ public:
 	const char* inputFile;
 	const char* outputFile;
 	float scoreThr;
+	int numThreads;
+	const char* socketPath;
+	bool stream;
+	const char* genesFile;
+	const char* genesFormat;
+	double minAlignedFraction;
+	InputFormat *inputFormat;   // NULL for the MyTaxa input format
+	HitFilter hitFilter;
+	ScoreWeights scoreWeights;
+	bool customScoring;         // any of the scoring options given
+	int model;                  // MODEL_LIKELIHOOD or MODEL_LCA
 		
 	void printArgs(){
 		cout << "## The input file is: " << inputFile << endl;
 		cout << "## The output will be stored at: " << outputFile << endl;
 		cout << "## The output score cutoff is: " << scoreThr <<endl;
+		cout << "## Number of threads: " << numThreads <<endl;
+		if(hitFilter.maxHitsPerGene > 0){
+			cout << "## Hits kept per gene: " << hitFilter.maxHitsPerGene << endl;
+		}
+		printTaxa("## Only hits under taxa:", hitFilter.includeTaxa);
+		printTaxa("## Ignoring hits under taxa:", hitFilter.excludeTaxa);
+		if(genesFile != NULL){
+			cout << "## The gene predictions (" << genesFormat << ") are read from: " << genesFile << endl;
+		}
+		if(model == MODEL_LCA){
+			cout << "## Classifying by the lowest common ancestor of the hits" << endl;
+		}else if(customScoring){
+			printScoring();
+		}
+	}
+	
+	void printTaxa(const char *title, const vector<IDnum> &taxa){
+		if(taxa.empty()){
+			return;
+		}
+		cout << title;
+		for(unsigned int i = 0; i < taxa.size(); i++){
+			cout << " " << taxa[i];
+		}
+		cout << endl;
+	}
+	
+	void printScoring(){
+		cout << "## Scoring weights:";
+		for(int rank = 0; rank < 3; rank++){
+			cout << " " << scoreWeights.dualHist[rank];
+		}
+		for(int rank = 0; rank < 3; rank++){
+			cout << " " << scoreWeights.subMTX[rank];
+		}
+		cout << endl;
+		cout << "## Bitscore drop: " << hitFilter.scoreDropThr << ", minimum identity: " << hitFilter.minIdentity
+			<< ", minimum bitscore: " << hitFilter.minBitscore << endl;
+	}
+	
+	// --include-taxa or --exclude-taxa given;
+	bool filtersTaxa(){
+		return !hitFilter.includeTaxa.empty() || !hitFilter.excludeTaxa.empty();
+	}
+	
+	// the tabular input format asked for by --genes or --genes-format no;
+	void loadInputFormat(){
+		inputFormat = NULL;
+		if(genesFile != NULL || strcmp(genesFormat, "no") == 0){
+			inputFormat = loadGenePredictions(genesFile, genesFormat, minAlignedFraction);
+		}
 	}
 }Args;
 
-void initArgs(int argc, char** argv, commandArgs &Args){
-	if (argc != 4) {
+// a whole argument as a number, false if it is not one;
+bool parseNumber(const char *text, double &number){
+	char *end;
+	number = strtod(text, &end);
+	return end != text && *end == '\0';
+}
+
+// six comma separated weights, W10 to W22;
+bool parseWeights(const char *list, ScoreWeights &weights){
+	vector<string> values = split(list, ',');
+	if(values.size() != 6){
+		return false;
+	}
+	double dualHist[3], subMTX[3];
+	for(int rank = 0; rank < 3; rank++){
+		if(!parseNumber(values[rank].c_str(), dualHist[rank]) || !parseNumber(values[rank+3].c_str(), subMTX[rank])){
+			return false;
+		}
+	}
+	for(int rank = 0; rank < 3; rank++){
+		weights.dualHist[rank] = dualHist[rank];
+		weights.subMTX[rank] = subMTX[rank];
+	}
+	return true;
+}
+
+// comma separated taxonIDs, appended to taxa;
+bool parseTaxa(const char *list, vector<IDnum> &taxa){
+	vector<string> values = split(list, ',');
+	for(unsigned int i = 0; i < values.size(); i++){
+		char *end;
+		long taxonID = strtol(values[i].c_str(), &end, 10);
+		if(end == values[i].c_str() || *end != '\0' || taxonID < 1 || taxonID > INT32_MAX){
+			return false;
+		}
+		taxa.push_back(taxonID);
+	}
+	return !values.empty();
+}
+
+// options may appear anywhere in argv[first..], the other arguments are
+// returned in order; they are applied in order, so that options after
+// --params override it;
+vector<char *> parseOptions(int argc, char** argv, commandArgs &Args, int first){
+	vector<char *> positional;
+	Args.numThreads = thread::hardware_concurrency();
+	Args.socketPath = NULL;
+	Args.stream = false;
+	Args.genesFile = NULL;
+	Args.genesFormat = "gff2";
+	Args.minAlignedFraction = 0.75;
+	initHitFilter(Args.hitFilter);
+	initScoreWeights(Args.scoreWeights);
+	Args.customScoring = false;
+	Args.model = MODEL_LIKELIHOOD;
+	for(int i = first; i < argc; i++){
+		if(strcmp(argv[i], "--threads") == 0){
+			if(i + 1 >= argc || atoi(argv[i+1]) < 1){
+				throw myex;
+			}
+			Args.numThreads = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--socket") == 0){
+			if(i + 1 >= argc){
+				throw myex;
+			}
+			Args.socketPath = argv[++i];
+		}else if(strcmp(argv[i], "--stream") == 0){
+			Args.stream = true;
+		}else if(strcmp(argv[i], "--genes") == 0){
+			if(i + 1 >= argc){
+				throw myex;
+			}
+			Args.genesFile = argv[++i];
+		}else if(strcmp(argv[i], "--genes-format") == 0){
+			if(i + 1 >= argc){
+				throw myex;
+			}
+			Args.genesFormat = argv[++i];
+		}else if(strcmp(argv[i], "--min-aligned-fraction") == 0){
+			if(i + 1 >= argc || !parseNumber(argv[i+1], Args.minAlignedFraction)){
+				throw myex;
+			}
+			i++;
+		}else if(strcmp(argv[i], "--max-hits-per-gene") == 0){
+			if(i + 1 >= argc || atoi(argv[i+1]) < 0){
+				throw myex;
+			}
+			Args.hitFilter.maxHitsPerGene = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--mode") == 0){
+			if(i + 1 >= argc){
+				throw myex;
+			}
+			i++;
+			if(strcmp(argv[i], "likelihood") == 0){
+				Args.model = MODEL_LIKELIHOOD;
+			}else if(strcmp(argv[i], "lca") == 0){
+				Args.model = MODEL_LCA;
+			}else{
+				throw myex;
+			}
+		}else if(strcmp(argv[i], "--include-taxa") == 0){
+			if(i + 1 >= argc || !parseTaxa(argv[i+1], Args.hitFilter.includeTaxa)){
+				throw myex;
+			}
+			i++;
+		}else if(strcmp(argv[i], "--exclude-taxa") == 0){
+			if(i + 1 >= argc || !parseTaxa(argv[i+1], Args.hitFilter.excludeTaxa)){
+				throw myex;
+			}
+			i++;
+		}else if(strcmp(argv[i], "--params") == 0){
+			if(i + 1 >= argc){
+				throw myex;
+			}
+			loadScoringParams(argv[++i], Args.scoreWeights, Args.hitFilter);
+			Args.customScoring = true;
+		}else if(strcmp(argv[i], "--weights") == 0){
+			if(i + 1 >= argc || !parseWeights(argv[i+1], Args.scoreWeights)){
+				throw myex;
+			}
+			i++;
+			Args.customScoring = true;
+		}else if(strcmp(argv[i], "--score-drop") == 0){
+			if(i + 1 >= argc || !parseNumber(argv[i+1], Args.hitFilter.scoreDropThr)){
+				throw myex;
+			}
+			i++;
+			Args.customScoring = true;
+		}else if(strcmp(argv[i], "--min-identity") == 0){
+			if(i + 1 >= argc || !parseNumber(argv[i+1], Args.hitFilter.minIdentity)){
+				throw myex;
+			}
+			i++;
+			Args.customScoring = true;
+		}else if(strcmp(argv[i], "--min-bitscore") == 0){
+			if(i + 1 >= argc || !parseNumber(argv[i+1], Args.hitFilter.minBitscore)){
+				throw myex;
+			}
+			i++;
+			Args.customScoring = true;
+		}else{
+			positional.push_back(argv[i]);
+		}
+	}
+	if(Args.numThreads < 1){
+		Args.numThreads = 1;
+	}
+	if(Args.genesFile == NULL && strcmp(Args.genesFormat, "no") != 0 && strcmp(Args.genesFormat, "gff2") != 0){
+		// a gene format without gene file;
+		throw myex;
+	}
+	return positional;
+}
+
+// argv[first..] are the arguments of the run, after the command name if any;
+void initArgs(int argc, char** argv, commandArgs &Args, int first = 1){
+	vector<char *> positional = parseOptions(argc, argv, Args, first);
+	if (positional.size() != 3 && positional.size() != 4) {
 		throw myex;
 	}else{
 		try{
-			Args.inputFile = realpath(argv[1], NULL);
+			// "-" reads the input from stdin;
+			Args.inputFile = (strcmp(positional[0], STDIN_PATH) == 0)?STDIN_PATH:realpath(positional[0], NULL);
 			if(Args.inputFile == NULL){
 				throw myex;
 			}
-			Args.outputFile = argv[2];
-			Args.scoreThr = atof(argv[3]);
+			Args.outputFile = positional[1];
+			Args.scoreThr = atof(positional[2]);
+			// the [num hits] of the original command line;
+			if(positional.size() == 4){
+				if(atoi(positional[3]) < 0){
+					throw myex;
+				}
+				Args.hitFilter.maxHitsPerGene = atoi(positional[3]);
+			}
 		}catch(exception &e){
 			cerr << "Argument error: " << e.what() << endl;
 			exit(1);
@@ -75,10 +342,13 @@ void initArgs(int argc, char** argv, commandArgs &Args){
 //class that defines all the files in the ./db directory
 class databaseFiles{
 public:
+	const char* dbDir;
 	const char* taxonTreeFile;
 	const char* taxonSciNameFile;
 	const char* geneTaxonFile;
 	const char* geneInfoFile;
+	const char* imageFile;
+	const char* socketFile;
 	
 	void initDBFiles(char *progPath){
 		string progString = string(progPath);
@@ -88,18 +358,493 @@ public:
 		string taxonSciNameFileString = dbPathString + "ncbiSciNames.lib";
 		string geneTaxonFileString = dbPathString + "geneTaxon.lib";
 		string geneInfoFileString = dbPathString + "geneInfo.lib";
+		string imageFileString = dbPathString + DB_IMAGE_NAME;
 		
-		taxonTreeFile = realpath(taxonTreeFileString.c_str(), NULL);
-		taxonSciNameFile = realpath(taxonSciNameFileString.c_str(), NULL);
-		geneTaxonFile = realpath(geneTaxonFileString.c_str(), NULL);
-		geneInfoFile = realpath(geneInfoFileString.c_str(), NULL);
+		dbDir = strdup(dbPathString.c_str());
+		taxonTreeFile = realpath(findInputFile(taxonTreeFileString).c_str(), NULL);
+		taxonSciNameFile = realpath(findInputFile(taxonSciNameFileString).c_str(), NULL);
+		geneTaxonFile = realpath(findInputFile(geneTaxonFileString).c_str(), NULL);
+		geneInfoFile = realpath(findInputFile(geneInfoFileString).c_str(), NULL);
+		imageFile = strdup(imageFileString.c_str());
+		socketFile = strdup((dbPathString + SERVE_SOCKET_NAME).c_str());
+	}
+	
+	// map db/MyTaxa.db if it exists and is up to date, NULL otherwise;
+	DBImage *openImage(){
+		const char *sources[DB_NUM_SOURCES];
+		sources[DB_SRC_NODES] = taxonTreeFile;
+		sources[DB_SRC_NAMES] = taxonSciNameFile;
+		sources[DB_SRC_GENE_TAXON] = geneTaxonFile;
+		sources[DB_SRC_GENE_INFO] = geneInfoFile;
+		return openDBImage(imageFile, sources);
+	}
+	
+	// NCBI taxonomy tree and names, from the image when there is one; without
+	// it, lazyNames defers reading the names to the output of a single run;
+	// the LCA index of the tree is built too if lcaIndex is not NULL, and the
+	// tree is labelled for the taxa of --include-taxa and --exclude-taxa,
+	// which must be in it;
+	void loadTaxonomy(DBImage *dbImage, TaxonTree **tTree, TaxonName **sciName, bool lazyNames, LCAIndex **lcaIndex){
+		if(dbImage != NULL){
+			*tTree = importTaxonTreeFromImage(dbImage);
+			*sciName = importTaxonNameFromImage(dbImage);
+		}else{
+			*tTree = importTaxonTreeFromFile(taxonTreeFile);
+			*sciName = lazyNames?openTaxonNameFile(taxonSciNameFile):importTaxonNameFromFile(taxonSciNameFile);
+		}
+		if(lcaIndex != NULL){
+			*lcaIndex = buildLCAIndex(*tTree);
+		}
+		if(Args.filtersTaxa()){
+			checkTaxa(*tTree, Args.hitFilter.includeTaxa);
+			checkTaxa(*tTree, Args.hitFilter.excludeTaxa);
+			labelTaxonTree(*tTree);
+		}
+	}
+	
+	void checkTaxa(TaxonTree *tTree, const vector<IDnum> &taxa){
+		for(unsigned int i = 0; i < taxa.size(); i++){
+			if(!taxonInTree(tTree, taxa[i])){
+				cerr << "Taxon " << taxa[i] << " is not in the NCBI taxonomy" << endl;
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	
+	// loadTaxonomy on a thread of its own, unless a single thread is allowed:
+	// then it is loaded right away and the thread returned is not joinable;
+	thread loadTaxonomyInBackground(DBImage *dbImage, TaxonTree **tTree, TaxonName **sciName, bool lazyNames, LCAIndex **lcaIndex){
+		if(Args.numThreads < 2){
+			cout << "Loading NCBI taxonomy information..."<<endl;
+			loadTaxonomy(dbImage, tTree, sciName, lazyNames, lcaIndex);
+			cout << "Done!" << endl;
+			return thread();
+		}
+		cout << "Loading NCBI taxonomy information in the background..."<<endl;
+		return thread(&databaseFiles::loadTaxonomy, this, dbImage, tTree, sciName, lazyNames, lcaIndex);
+	}
+	
+	// GI->taxonID and GI->gene cluster parameters of all hits in QuerySeq; the
+	// two libraries fill different columns of QuerySeq, so they load in parallel
+	// given two threads or more; the text libraries share numThreads threads;
+	void loadGeneLibraries(DBImage *dbImage, QueryBatch &QuerySeq, int numThreads){
+		if(numThreads < 2){
+			if(dbImage != NULL){
+				loadGI2TaxonLibFromImage(dbImage, QuerySeq);
+				loadGI2ClstrLibFromImage(dbImage, QuerySeq);
+			}else{
+				loadGI2TaxonLibFromFile(geneTaxonFile, QuerySeq, 1);
+				loadGI2ClstrLibFromFile(geneInfoFile, QuerySeq, 1);
+			}
+			return;
+		}
+		thread taxonLoader;
+		if(dbImage != NULL){
+			taxonLoader = thread(loadGI2TaxonLibFromImage, dbImage, ref(QuerySeq));
+			loadGI2ClstrLibFromImage(dbImage, QuerySeq);
+		}else{
+			int taxonThreads = gi2TaxonScanThreads(geneTaxonFile, geneInfoFile, numThreads);
+			taxonLoader = thread(loadGI2TaxonLibFromFile, geneTaxonFile, ref(QuerySeq), taxonThreads);
+			loadGI2ClstrLibFromFile(geneInfoFile, QuerySeq, numThreads - taxonThreads);
+		}
+		taxonLoader.join();
 	}
 	
 }dbFiles;
 
+// the threads --threads leaves to the gene libraries while the taxonomy
+// may still be loading on its own;
+static int threadsBesides(const thread &taxonomyLoader){
+	return taxonomyLoader.joinable()?Args.numThreads - 1:Args.numThreads;
+}
+
+// MyTaxa build-db [db directory]
+int buildDB(int argc, char** argv){
+	dbFiles.initDBFiles(argv[0]);
+	const char *dbDir = (argc > 2)?argv[2]:dbFiles.dbDir;
+	cout << "Building database image in " << dbDir << endl;
+	return buildDBImage(dbDir);
+}
+
+// MyTaxa check-db
+int checkDB(int argc, char** argv){
+	dbFiles.initDBFiles(argv[0]);
+	DBImage *dbImage = dbFiles.openImage();
+	if(dbImage == NULL){
+		cerr << "No usable database image at " << dbFiles.imageFile << endl;
+		return 1;
+	}
+	bool ok = verifyDBImage(dbImage);
+	closeDBImage(dbImage);
+	cout << dbFiles.imageFile << (ok?": OK":": checksum mismatch, please run MyTaxa build-db") << endl;
+	return ok?0:1;
+}
+
+
+// print "<option>: why" and return true if any of the NULL terminated
+// options is given in argv[first..], for those a command does not take;
+static bool rejectOptions(int argc, char** argv, int first, const char *options[], const char *why){
+	for(int i = first; i < argc; i++){
+		for(int option = 0; options[option] != NULL; option++){
+			if(strcmp(argv[i], options[option]) == 0){
+				cerr << options[option] << ": " << why << endl;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// the jobs of serve are read in the MyTaxa input format only;
+static const char *geneOptions[] = {"--genes", "--genes-format", "--min-aligned-fraction", NULL};
+
+// the model, scoring and hit filter options of client: serve applies its
+// own to all its jobs, each on a single thread;
+static const char *servedOptions[] = {"--mode", "--params", "--weights", "--score-drop", "--min-identity", "--min-bitscore",
+										"--include-taxa", "--exclude-taxa", NULL};
+
+static const char *threadOptions[] = {"--threads", NULL};
+
+static const char *streamOptions[] = {"--stream", NULL};
+
+static const char *socketOptions[] = {"--socket", NULL};
+
+// MyTaxa serve [--socket PATH] [scoring options]
+int serve(int argc, char** argv){
+	try{
+		if(parseOptions(argc, argv, Args, 2).size() != 0){
+			throw myex;
+		}
+	}catch(exception& e){
+		printUsage();
+		return 1;
+	}
+	if(rejectOptions(argc, argv, 2, geneOptions, "the server only reads the MyTaxa input format, please convert the input with utils/infile_convert.pl")
+		|| rejectOptions(argc, argv, 2, streamOptions, "the server reads every job a window of query sequences at a time")){
+		return 1;
+	}
+	const char *socketPath = Args.socketPath;
+	dbFiles.initDBFiles(argv[0]);
+	if(socketPath == NULL){
+		socketPath = dbFiles.socketFile;
+	}
+	
+	// jobs look their GIs up in the mapped image, so nothing but the input is
+	// parsed per job; reading it through once also checks it and warms the page cache;
+	DBImage *dbImage = dbFiles.openImage();
+	if(dbImage == NULL){
+		cerr << "No up to date " << dbFiles.imageFile << ", please run MyTaxa build-db first" << endl;
+		return 1;
+	}
+	cout << "Verifying compiled database image " << dbFiles.imageFile << endl;
+	if(!verifyDBImage(dbImage)){
+		cerr << dbFiles.imageFile << ": checksum mismatch, please run MyTaxa build-db" << endl;
+		closeDBImage(dbImage);
+		return 1;
+	}
+	
+	cout << "Loading NCBI taxonomy information..." << endl;
+	TaxonTree *tTree;
+	TaxonName *sciName;
+	LCAIndex *lcaIndex = NULL;
+	dbFiles.loadTaxonomy(dbImage, &tTree, &sciName, false, (Args.model == MODEL_LCA)?&lcaIndex:NULL);
+	cout << "Done!" << endl;
+	
+	if(Args.model == MODEL_LCA){
+		cout << "## Classifying by the lowest common ancestor of the hits" << endl;
+	}else if(Args.customScoring){
+		Args.printScoring();
+	}
+	Args.printTaxa("## Only hits under taxa:", Args.hitFilter.includeTaxa);
+	Args.printTaxa("## Ignoring hits under taxa:", Args.hitFilter.excludeTaxa);
+	Args.hitFilter.tTree = tTree;
+	Args.hitFilter.image = dbImage;
+	cout << "## Jobs run at once: " << Args.numThreads << endl;
+	int status = serveJobs(socketPath, tTree, sciName, dbImage, &Args.scoreWeights, &Args.hitFilter, lcaIndex, Args.numThreads);
+	destroyLCAIndex(lcaIndex);
+	destroyTaxonTree(tTree);
+	destroyTaxonName(sciName);
+	closeDBImage(dbImage);
+	return status;
+}
+
+// MyTaxa client [--socket PATH] <input file> <output file> <score cutoff>
+int client(int argc, char** argv){
+	try{
+		initArgs(argc, argv, Args, 2);
+	}catch(exception& e){
+		cout<< e.what()<<endl;
+		printUsage();
+		return 1;
+	}
+	if(rejectOptions(argc, argv, 2, geneOptions, "the server only reads the MyTaxa input format, please convert the input with utils/infile_convert.pl")
+		|| rejectOptions(argc, argv, 2, servedOptions, "set on MyTaxa serve, which applies it to all its jobs")
+		|| rejectOptions(argc, argv, 2, threadOptions, "the server runs each job on a single thread")
+		|| rejectOptions(argc, argv, 2, streamOptions, "the server reads every job a window of query sequences at a time")){
+		return 1;
+	}
+	if(strcmp(Args.inputFile, STDIN_PATH) == 0){
+		cerr << "The server cannot read the client's stdin, please give an input file" << endl;
+		return 1;
+	}
+	if(Args.socketPath == NULL){
+		dbFiles.initDBFiles(argv[0]);
+		Args.socketPath = dbFiles.socketFile;
+	}
+	return submitJob(Args.socketPath, Args.inputFile, Args.outputFile, Args.scoreThr, Args.hitFilter.maxHitsPerGene);
+}
+
+
+// score the query sequences with the model of --mode;
+void classifyQueries(TaxonTree *tTree, LCAIndex *lcaIndex, QueryBatch &QuerySeq){
+	if(Args.model == MODEL_LCA){
+		lcaCal(lcaIndex, QuerySeq, Args.numThreads);
+	}else{
+		likelihoodCal(tTree, QuerySeq, Args.numThreads, &Args.scoreWeights);
+	}
+}
+
+// --include-taxa and --exclude-taxa filter the hits as they are read, which
+// needs the taxonomy and the taxa of the input GIs first: looked up in the
+// image, or resolved from the text libraries for all inputFiles at once,
+// along with their gene clusters, into tables;
+void prepareTaxonFilter(DBImage *dbImage, TaxonTree *tTree, const vector<string> &inputFiles, GeneTables *tables){
+	Args.hitFilter.tTree = tTree;
+	Args.hitFilter.image = dbImage;
+	if(dbImage != NULL){
+		return;
+	}
+	cout << "Collecting the GIs of the input..." << endl;
+	for(unsigned int input = 0; input < inputFiles.size(); input++){
+		collectInputGIs(inputFiles[input].c_str(), Args.inputFormat, &Args.hitFilter, tables->gi2taxon);
+	}
+	tables->gi2clstr = tables->gi2taxon;
+	cout << "Done!" << endl;
+	
+	cout << "Loading gi2taxonID library and gene cluster information and parameters..." << endl;
+	resolveGeneTablesFromFiles(dbFiles.geneTaxonFile, dbFiles.geneInfoFile, tables, Args.numThreads);
+	Args.hitFilter.gi2taxon = &tables->gi2taxon;
+	cout << "Done!" << endl;
+}
+
+// MyTaxa batch [--threads N] <manifest file> <score cutoff>
+// every line of the manifest is "<input file>\t<output file>"; the GIs of all
+// inputs are resolved in one pass over the database, then each sample is
+// scored and written on its own;
+int batch(int argc, char** argv){
+	vector<char *> positional;
+	try{
+		positional = parseOptions(argc, argv, Args, 2);
+		if(positional.size() != 2){
+			throw myex;
+		}
+	}catch(exception& e){
+		cout<< e.what()<<endl;
+		printUsage();
+		return 1;
+	}
+	if(rejectOptions(argc, argv, 2, streamOptions, "a batch holds all its samples at once, run them one by one with --stream for bounded memory")
+		|| rejectOptions(argc, argv, 2, socketOptions, "only serve and client use a socket")){
+		return 1;
+	}
+	Args.scoreThr = atof(positional[1]);
+	
+	vector<string> inputFiles;
+	vector<string> outputFiles;
+	ifstream manifest(positional[0]);
+	if(!manifest.is_open()){
+		cerr << "Could not open manifest file: " << positional[0] << endl;
+		return 1;
+	}
+	string line;
+	while(getline(manifest, line)){
+		if(line.empty() || line[0] == '#'){
+			continue;
+		}
+		vector<string> fields = split(line, '\t');
+		char *inputFile = realpath(fields[0].c_str(), NULL);
+		if(fields.size() != 2 || inputFile == NULL){
+			cerr << "Bad manifest line (input file missing?): " << line << endl;
+			return 1;
+		}
+		inputFiles.push_back(inputFile);
+		outputFiles.push_back(fields[1]);
+		free(inputFile);
+	}
+	cout << "## Samples in the batch: " << inputFiles.size() << endl;
+	cout << "## The output score cutoff is: " << Args.scoreThr <<endl;
+	Args.loadInputFormat();
+	
+	dbFiles.initDBFiles(argv[0]);
+	DBImage *dbImage = dbFiles.openImage();
+	if(dbImage != NULL){
+		cout << "Using compiled database image " << dbFiles.imageFile << endl;
+	}
+	
+	TaxonTree *tTree;
+	TaxonName *sciName;
+	LCAIndex *lcaIndex = NULL;
+	thread taxonomyLoader = dbFiles.loadTaxonomyInBackground(dbImage, &tTree, &sciName, false,
+							(Args.model == MODEL_LCA)?&lcaIndex:NULL);
+	
+	GeneTables tables;
+	if(Args.filtersTaxa()){
+		if(taxonomyLoader.joinable()){
+			cout << "Waiting for NCBI taxonomy information..."<<endl;
+			taxonomyLoader.join();
+			cout << "Done!" << endl;
+		}
+		prepareTaxonFilter(dbImage, tTree, inputFiles, &tables);
+	}
+	
+	// all samples go through the gene libraries together, then are split again;
+	cout << "Loading input files..." << endl;
+	QueryBatch QuerySeq;
+	vector<unsigned int> firstSeqs;
+	for(unsigned int sample = 0; sample < inputFiles.size(); sample++){
+		firstSeqs.push_back(QuerySeq.seqs.size());
+		loadInfoFromInputFile(inputFiles[sample].c_str(), QuerySeq, Args.inputFormat, &Args.hitFilter);
+	}
+	firstSeqs.push_back(QuerySeq.seqs.size());
+	cout << "Done!" << endl;
+	
+	if(Args.hitFilter.gi2taxon != NULL){
+		assignGeneTables(&tables, QuerySeq);
+	}else{
+		cout << "Loading gi2taxonID library and gene cluster information and parameters..." << endl;
+		dbFiles.loadGeneLibraries(dbImage, QuerySeq, threadsBesides(taxonomyLoader));
+		cout << "Done!" << endl;
+	}
+	
+	if(taxonomyLoader.joinable()){
+		cout << "Waiting for NCBI taxonomy information..."<<endl;
+		taxonomyLoader.join();
+		cout << "Done!" << endl;
+	}
+	
+	cout << "Calculating likelihoods of taxonomy affiliations..." << endl;
+	classifyQueries(tTree, lcaIndex, QuerySeq);
+	cout << "Done!" << endl;
+	
+	for(unsigned int sample = 0; sample < inputFiles.size(); sample++){
+		cout << "Writing the results of " << inputFiles[sample] << "..." << endl;
+		writeResultsToOutputFile(outputFiles[sample].c_str(), tTree, sciName, QuerySeq, Args.scoreThr,
+									firstSeqs[sample], firstSeqs[sample+1]);
+	}
+	cout << "Done!" << endl;
+	
+	clearQueryBatch(QuerySeq);
+	destroyLCAIndex(lcaIndex);
+	destroyTaxonTree(tTree);
+	destroyTaxonName(sciName);
+	destroyInputFormat(Args.inputFormat);
+	closeDBImage(dbImage);
+	return 0;
+}
+
+
+// MyTaxa --stream <input file> <output file> <score cutoff>
+// memory is bounded by the database and STREAM_WINDOW query sequences: without
+// an image, a first pass over the input collects its GIs so the libraries are
+// scanned once, and a second pass classifies the queries window by window;
+int streamRun(char *progPath){
+	dbFiles.initDBFiles(progPath);
+	DBImage *dbImage = dbFiles.openImage();
+	if(dbImage != NULL){
+		cout << "Using compiled database image " << dbFiles.imageFile << endl;
+	}else if(strcmp(Args.inputFile, STDIN_PATH) == 0){
+		cerr << "--stream reads stdin only once, which needs the compiled database image (MyTaxa build-db)" << endl;
+		return 1;
+	}
+	
+	TaxonTree *tTree;
+	TaxonName *sciName;
+	LCAIndex *lcaIndex = NULL;
+	thread taxonomyLoader = dbFiles.loadTaxonomyInBackground(dbImage, &tTree, &sciName, false,
+							(Args.model == MODEL_LCA)?&lcaIndex:NULL);
+	
+	QueryReader *reader;
+	QueryBatch QuerySeq;
+	GeneTables tables;
+	if(dbImage == NULL){
+		cout << "Collecting the GIs of the input file..." << endl;
+		if(Args.filtersTaxa()){
+			// the hits left out by the taxon lists change those selected;
+			collectInputGIs(Args.inputFile, Args.inputFormat, &Args.hitFilter, tables.gi2taxon);
+		}else{
+			reader = openQueryReader(Args.inputFile, Args.inputFormat, &Args.hitFilter);
+			while(readQuerySequences(reader, QuerySeq, STREAM_WINDOW) > 0){
+				collectQueryGIs(QuerySeq, tables.gi2taxon);
+				clearQueryBatch(QuerySeq);
+			}
+			closeQueryReader(reader);
+		}
+		tables.gi2clstr = tables.gi2taxon;
+		cout << "Done!" << endl;
+		
+		cout << "Loading gi2taxonID library and gene cluster information and parameters..." << endl;
+		resolveGeneTablesFromFiles(dbFiles.geneTaxonFile, dbFiles.geneInfoFile, &tables, threadsBesides(taxonomyLoader));
+		cout << "Done!" << endl;
+	}
+	
+	if(taxonomyLoader.joinable()){
+		cout << "Waiting for NCBI taxonomy information..."<<endl;
+		taxonomyLoader.join();
+		cout << "Done!" << endl;
+	}
+	
+	Args.hitFilter.tTree = tTree;
+	Args.hitFilter.image = dbImage;
+	Args.hitFilter.gi2taxon = (dbImage == NULL)?&tables.gi2taxon:NULL;
+	
+	cout << "Classifying the input file..." << endl;
+	ofstream outputFile;
+	outputFile.open(Args.outputFile, ios::out);
+	reader = openQueryReader(Args.inputFile, Args.inputFormat, &Args.hitFilter);
+	while(readQuerySequences(reader, QuerySeq, STREAM_WINDOW) > 0){
+		if(dbImage != NULL){
+			loadGI2TaxonLibFromImage(dbImage, QuerySeq);
+			loadGI2ClstrLibFromImage(dbImage, QuerySeq);
+		}else{
+			assignGeneTables(&tables, QuerySeq);
+		}
+		classifyQueries(tTree, lcaIndex, QuerySeq);
+		writeResults(outputFile, tTree, sciName, QuerySeq, Args.scoreThr);
+		clearQueryBatch(QuerySeq);
+	}
+	closeQueryReader(reader);
+	outputFile.close();
+	cout << "Done!" << endl;
+	
+	destroyLCAIndex(lcaIndex);
+	destroyTaxonTree(tTree);
+	destroyTaxonName(sciName);
+	destroyInputFormat(Args.inputFormat);
+	closeDBImage(dbImage);
+	cout << "All finished, results are stored in " << Args.outputFile << endl;
+	return 0;
+}
+
 
 ////////////////////////// MAIN ///////////////////////
 int main(int argc, char** argv){
+	// database maintenance commands
+	if(argc >= 2 && strcmp(argv[1], "build-db") == 0){
+		return buildDB(argc, argv);
+	}
+	if(argc >= 2 && strcmp(argv[1], "check-db") == 0){
+		return checkDB(argc, argv);
+	}
+	if(argc >= 2 && strcmp(argv[1], "batch") == 0){
+		return batch(argc, argv);
+	}
+	if(argc >= 2 && strcmp(argv[1], "serve") == 0){
+		return serve(argc, argv);
+	}
+	if(argc >= 2 && strcmp(argv[1], "client") == 0){
+		return client(argc, argv);
+	}
+	
 	//init the argument for the run
 	try{
 		initArgs(argc, argv, Args);
@@ -109,44 +854,67 @@ int main(int argc, char** argv){
 		printUsage();
 		return 1;	
 	}
+	if(rejectOptions(argc, argv, 1, socketOptions, "only serve and client use a socket")){
+		return 1;
+	}
+	Args.loadInputFormat();
+	if(Args.stream){
+		return streamRun(argv[0]);
+	}
 	
 	//load all the ./db file vars;
 	dbFiles.initDBFiles(argv[0]);
+	DBImage *dbImage = dbFiles.openImage();
+	if(dbImage != NULL){
+		cout << "Using compiled database image " << dbFiles.imageFile << endl;
+	}else if(Args.filtersTaxa() && strcmp(Args.inputFile, STDIN_PATH) == 0){
+		cerr << "--include-taxa and --exclude-taxa read stdin only once, which needs the compiled database image (MyTaxa build-db)" << endl;
+		return 1;
+	}
 	
-	//load ncbi taxonomy libs
-	
-	cout << "Loading NCBI taxonomy information..."<<endl;
+	// the taxonomy does not depend on the input, load it while parsing;
 	TaxonTree *tTree;
 	TaxonName *sciName;
-	tTree = importTaxonTreeFromFile(dbFiles.taxonTreeFile);
-	sciName = importTaxonNameFromFile(dbFiles.taxonSciNameFile);
-	cout << "Done!" << endl;
+	LCAIndex *lcaIndex = NULL;
+	thread taxonomyLoader = dbFiles.loadTaxonomyInBackground(dbImage, &tTree, &sciName, true,
+							(Args.model == MODEL_LCA)?&lcaIndex:NULL);
+	
+	// the taxon lists need the taxonomy before the input;
+	GeneTables tables;
+	if(Args.filtersTaxa()){
+		if(taxonomyLoader.joinable()){
+			cout << "Waiting for NCBI taxonomy information..."<<endl;
+			taxonomyLoader.join();
+			cout << "Done!" << endl;
+		}
+		prepareTaxonFilter(dbImage, tTree, vector<string>(1, Args.inputFile), &tables);
+	}
 	
-	//  read input file, load all gi# into vector<IDnum> gis, and initialize
-	//  the vector<Sequence*> querySequences; 
+	//  read input file, load all gi# and the query sequences into the hit
+	//  columns of QuerySeq;
 	cout << "Loading input file..." << endl;
-	vector<Sequence> QuerySeq;
-	QuerySeq.clear();
-	QuerySeq = loadInfoFromInputFile(Args.inputFile);
-	vector<string> seqNames;
-//	return 0;	
+	QueryBatch QuerySeq;
+	loadInfoFromInputFile(Args.inputFile, QuerySeq, Args.inputFormat, &Args.hitFilter);
 	cout << "Done!" << endl;	
 	
-	// load pre-calculated parameters
-	// step 1, load GI->taxonID
-	cout << "Loading gi2taxonID library..." << endl;
-	loadGI2TaxonLibFromFile(dbFiles.geneTaxonFile, QuerySeq);
-	cout << "Done!" << endl;
-	
+	// load pre-calculated parameters: GI->taxonID and GI->gene cluster
+	if(Args.hitFilter.gi2taxon != NULL){
+		assignGeneTables(&tables, QuerySeq);
+	}else{
+		cout << "Loading gi2taxonID library and gene cluster information and parameters..." << endl;
+		dbFiles.loadGeneLibraries(dbImage, QuerySeq, threadsBesides(taxonomyLoader));
+		cout << "Done!" << endl;
+	}
 	
-	// step 2, load GI->gene cluster
-	cout << "Loading gene cluster information and parameters..." << endl;
-	loadGI2ClstrLibFromFile(dbFiles.geneInfoFile, QuerySeq);
-	cout << "Done!" << endl;
+	if(taxonomyLoader.joinable()){
+		cout << "Waiting for NCBI taxonomy information..."<<endl;
+		taxonomyLoader.join();
+		cout << "Done!" << endl;
+	}
 	
 	// step 3, calculate the taxonomy for each query sequence.
 	cout << "Calculating likelihoods of taxonomy affiliations..." << endl;
-	likelihoodCal(tTree, QuerySeq);
+	classifyQueries(tTree, lcaIndex, QuerySeq);
 	cout << "Done!" << endl;
 	
 	// output results
@@ -156,8 +924,11 @@ int main(int argc, char** argv){
 	
 	// clean up;
 	cout << "Cleaning up..." << endl;
+	destroyLCAIndex(lcaIndex);
 	destroyTaxonTree(tTree);
 	destroyTaxonName(sciName);
+	destroyInputFormat(Args.inputFormat);
+	closeDBImage(dbImage);
 	
 	cout << "All finished, results are stored in " << Args.outputFile << endl;
 	cout << "Bye!" << endl;
@@ -10,5 +10,8 @@
 #include "taxonomy.h"
 #include "utility.h"
 #include "algo.h"
+#include "dbimage.h"
+#include "server.h"
+#include "instream.h"
 
 #endif
\ No newline at end of file
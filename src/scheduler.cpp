@@ -0,0 +1,119 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#include <vector>
+#include <thread>
+#include <mutex>
+
+#include "scheduler.h"
+
+using namespace std;
+
+// the items [begin, end) a thread has yet to run; the owner takes from the
+// front, thieves from the back;
+struct workSlice_st {
+	mutex lock;
+	size_t begin;
+	size_t end;
+};
+
+struct workStealing_st {
+	vector<workSlice_st> slices;
+	void (*work)(size_t index, int thread, void *arg);
+	void *arg;
+};
+
+// move the back half of the largest other slice to slice self; false once
+// every slice is empty. Only one lock is held at a time: the stolen items are
+// out of every slice until they are stored in self, which is empty and so
+// never stolen from meanwhile;
+static bool stealWork(workStealing_st *state, int self){
+	int numThreads = state->slices.size();
+	while(true){
+		int victim = -1;
+		size_t mostLeft = 0;
+		for(int offset = 1; offset < numThreads; offset++){
+			int other = (self + offset) % numThreads;
+			workSlice_st &slice = state->slices[other];
+			lock_guard<mutex> guard(slice.lock);
+			if(slice.end - slice.begin > mostLeft){
+				mostLeft = slice.end - slice.begin;
+				victim = other;
+			}
+		}
+		if(victim < 0){
+			return false;
+		}
+
+		size_t begin, end;
+		{
+			workSlice_st &slice = state->slices[victim];
+			lock_guard<mutex> guard(slice.lock);
+			if(slice.begin == slice.end){
+				continue;   // emptied since it was looked at
+			}
+			end = slice.end;
+			begin = end - (slice.end - slice.begin + 1) / 2;
+			slice.end = begin;
+		}
+		workSlice_st &own = state->slices[self];
+		lock_guard<mutex> guard(own.lock);
+		own.begin = begin;
+		own.end = end;
+		return true;
+	}
+}
+
+static void runWorker(workStealing_st *state, int self){
+	workSlice_st &own = state->slices[self];
+	while(true){
+		size_t index;
+		bool found = false;
+		{
+			lock_guard<mutex> guard(own.lock);
+			if(own.begin < own.end){
+				index = own.begin++;
+				found = true;
+			}
+		}
+		if(found){
+			state->work(index, self, state->arg);
+		}else if(!stealWork(state, self)){
+			return;
+		}
+	}
+}
+
+void runWorkStealing(size_t numItems, int numThreads, void (*work)(size_t index, int thread, void *arg), void *arg){
+	if(numThreads > (int) numItems){
+		numThreads = numItems;
+	}
+	if(numThreads <= 1){
+		for(size_t index = 0; index < numItems; index++){
+			work(index, 0, arg);
+		}
+		return;
+	}
+
+	workStealing_st state;
+	state.slices = vector<workSlice_st>(numThreads);
+	state.work = work;
+	state.arg = arg;
+	for(int thread = 0; thread < numThreads; thread++){
+		state.slices[thread].begin = numItems * thread / numThreads;
+		state.slices[thread].end = numItems * (thread + 1) / numThreads;
+	}
+
+	vector<std::thread> workers;
+	for(int thread = 1; thread < numThreads; thread++){
+		workers.push_back(std::thread(runWorker, &state, thread));
+	}
+	runWorker(&state, 0);
+	for(unsigned int index = 0; index < workers.size(); index++){
+		workers[index].join();
+	}
+}
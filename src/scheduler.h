@@ -0,0 +1,25 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stddef.h>
+
+using namespace std;
+
+// Work-stealing loop over the items [0, numItems). Every thread starts on an
+// equal slice of the items and takes them one at a time from its front; a
+// thread that runs out steals the back half of the largest slice left, so
+// items of very uneven cost (query sequences of one to thousands of genes)
+// still keep all threads busy until the end.
+
+// run work(index, thread, arg) once for every index, on numThreads threads
+// numbered from 0 (the calling thread); returns when all items are done;
+void runWorkStealing(size_t numItems, int numThreads, void (*work)(size_t index, int thread, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCORE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+#include "scorekernel.h"
+
+using namespace std;
+
+////////////////////////// SCALAR ////////////////////////
+
+static void weightHitScoresScalar(const float *dualHist, const float *subMTX, size_t numHits,
+									const float *weights1, const float *weights2, float *scores){
+	for(size_t hit = 0; hit < numHits; hit++){
+		for(int rank = 0; rank < 3; rank++){
+			size_t i = 3*hit + rank;
+			scores[i] = weights1[rank]*dualHist[i] + weights2[rank]*subMTX[i];
+		}
+	}
+}
+
+static void addHitScoresScalar(const float *dualHist, const float *subMTX, size_t numHits, float *scores){
+	for(size_t i = 0; i < 3 * numHits; i++){
+		scores[i] = dualHist[i] + subMTX[i];
+	}
+}
+
+// the first index of the highest of scores [begin, n) above floor, or n;
+static size_t firstHighestScore(const float *scores, size_t begin, size_t n, float floor){
+	size_t best = n;
+	for(size_t i = begin; i < n; i++){
+		if(scores[i] > floor){
+			floor = scores[i];
+			best = i;
+		}
+	}
+	return best;
+}
+
+// scores [begin, n) divided by sum, or 1 if sum is 0;
+static void divideScores(float *scores, size_t begin, size_t n, float sum){
+	for(size_t i = begin; i < n; i++){
+		if(sum != 0){
+			scores[i] /= sum;
+		}else{
+			scores[i] = 1.0;
+		}
+	}
+}
+
+static size_t normalizeScoresScalar(float *scores, size_t n, float sum){
+	divideScores(scores, 0, n, sum);
+	return firstHighestScore(scores, 0, n, 0);
+}
+
+#ifdef SCORE_KERNEL_X86
+////////////////////////// SSE ////////////////////////
+
+// the weights repeat every 3 values, so 12 values (4 hits, 3 vectors) are
+// weighted at a time;
+__attribute__((target("sse")))
+static void weightHitScoresSSE(const float *dualHist, const float *subMTX, size_t numHits,
+								const float *weights1, const float *weights2, float *scores){
+	__m128 w1[3], w2[3];
+	for(int v = 0; v < 3; v++){
+		w1[v] = _mm_setr_ps(weights1[(4*v) % 3], weights1[(4*v+1) % 3], weights1[(4*v+2) % 3], weights1[(4*v+3) % 3]);
+		w2[v] = _mm_setr_ps(weights2[(4*v) % 3], weights2[(4*v+1) % 3], weights2[(4*v+2) % 3], weights2[(4*v+3) % 3]);
+	}
+	size_t numValues = 3 * numHits;
+	size_t i = 0;
+	for(; i + 12 <= numValues; i += 12){
+		for(int v = 0; v < 3; v++){
+			__m128 dh = _mm_loadu_ps(dualHist + i + 4*v);
+			__m128 sm = _mm_loadu_ps(subMTX + i + 4*v);
+			_mm_storeu_ps(scores + i + 4*v, _mm_add_ps(_mm_mul_ps(w1[v], dh), _mm_mul_ps(w2[v], sm)));
+		}
+	}
+	weightHitScoresScalar(dualHist + i, subMTX + i, numHits - i/3, weights1, weights2, scores + i);
+}
+
+__attribute__((target("sse")))
+static void addHitScoresSSE(const float *dualHist, const float *subMTX, size_t numHits, float *scores){
+	size_t numValues = 3 * numHits;
+	size_t i = 0;
+	for(; i + 4 <= numValues; i += 4){
+		_mm_storeu_ps(scores + i, _mm_add_ps(_mm_loadu_ps(dualHist + i), _mm_loadu_ps(subMTX + i)));
+	}
+	for(; i < numValues; i++){
+		scores[i] = dualHist[i] + subMTX[i];
+	}
+}
+
+// vector maxima keep the running maximum, the second operand, over NaNs,
+// which never win the scalar comparison either;
+__attribute__((target("sse")))
+static size_t normalizeScoresSSE(float *scores, size_t n, float sum){
+	__m128 divisor = _mm_set1_ps(sum);
+	__m128 one = _mm_set1_ps(1.0);
+	__m128 highest = _mm_setzero_ps();
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4){
+		__m128 v = (sum != 0)?_mm_div_ps(_mm_loadu_ps(scores + i), divisor):one;
+		_mm_storeu_ps(scores + i, v);
+		highest = _mm_max_ps(v, highest);
+	}
+	divideScores(scores, i, n, sum);
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, highest);
+	float top = 0;
+	for(int lane = 0; lane < 4; lane++){
+		if(lanes[lane] > top){
+			top = lanes[lane];
+		}
+	}
+	// the first vector maximum, unless a tail score beats it;
+	size_t best = n;
+	if(top > 0){
+		for(best = 0; scores[best] != top; best++){
+		}
+	}
+	size_t tailBest = firstHighestScore(scores, n - n % 4, n, top);
+	return (tailBest < n)?tailBest:best;
+}
+
+////////////////////////// AVX2 ////////////////////////
+
+// 24 values (8 hits, 3 vectors) at a time;
+__attribute__((target("avx2")))
+static void weightHitScoresAVX2(const float *dualHist, const float *subMTX, size_t numHits,
+								const float *weights1, const float *weights2, float *scores){
+	__m256 w1[3], w2[3];
+	for(int v = 0; v < 3; v++){
+		float pattern1[8], pattern2[8];
+		for(int lane = 0; lane < 8; lane++){
+			pattern1[lane] = weights1[(8*v + lane) % 3];
+			pattern2[lane] = weights2[(8*v + lane) % 3];
+		}
+		w1[v] = _mm256_loadu_ps(pattern1);
+		w2[v] = _mm256_loadu_ps(pattern2);
+	}
+	size_t numValues = 3 * numHits;
+	size_t i = 0;
+	for(; i + 24 <= numValues; i += 24){
+		for(int v = 0; v < 3; v++){
+			__m256 dh = _mm256_loadu_ps(dualHist + i + 8*v);
+			__m256 sm = _mm256_loadu_ps(subMTX + i + 8*v);
+			_mm256_storeu_ps(scores + i + 8*v, _mm256_add_ps(_mm256_mul_ps(w1[v], dh), _mm256_mul_ps(w2[v], sm)));
+		}
+	}
+	weightHitScoresScalar(dualHist + i, subMTX + i, numHits - i/3, weights1, weights2, scores + i);
+}
+
+__attribute__((target("avx2")))
+static void addHitScoresAVX2(const float *dualHist, const float *subMTX, size_t numHits, float *scores){
+	size_t numValues = 3 * numHits;
+	size_t i = 0;
+	for(; i + 8 <= numValues; i += 8){
+		_mm256_storeu_ps(scores + i, _mm256_add_ps(_mm256_loadu_ps(dualHist + i), _mm256_loadu_ps(subMTX + i)));
+	}
+	for(; i < numValues; i++){
+		scores[i] = dualHist[i] + subMTX[i];
+	}
+}
+
+__attribute__((target("avx2")))
+static size_t normalizeScoresAVX2(float *scores, size_t n, float sum){
+	__m256 divisor = _mm256_set1_ps(sum);
+	__m256 one = _mm256_set1_ps(1.0);
+	__m256 highest = _mm256_setzero_ps();
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8){
+		__m256 v = (sum != 0)?_mm256_div_ps(_mm256_loadu_ps(scores + i), divisor):one;
+		_mm256_storeu_ps(scores + i, v);
+		highest = _mm256_max_ps(v, highest);
+	}
+	divideScores(scores, i, n, sum);
+
+	float lanes[8];
+	_mm256_storeu_ps(lanes, highest);
+	float top = 0;
+	for(int lane = 0; lane < 8; lane++){
+		if(lanes[lane] > top){
+			top = lanes[lane];
+		}
+	}
+	size_t best = n;
+	if(top > 0){
+		for(best = 0; scores[best] != top; best++){
+		}
+	}
+	size_t tailBest = firstHighestScore(scores, n - n % 8, n, top);
+	return (tailBest < n)?tailBest:best;
+}
+#endif
+
+////////////////////////// DISPATCH ////////////////////////
+
+// indexed by level, up to the levels built for this architecture;
+static const ScoreKernels kernelLevels[] = {
+	{SCORE_KERNEL_SCALAR, "scalar", weightHitScoresScalar, addHitScoresScalar, normalizeScoresScalar},
+#ifdef SCORE_KERNEL_X86
+	{SCORE_KERNEL_SSE, "sse", weightHitScoresSSE, addHitScoresSSE, normalizeScoresSSE},
+	{SCORE_KERNEL_AVX2, "avx2", weightHitScoresAVX2, addHitScoresAVX2, normalizeScoresAVX2}
+#endif
+};
+
+// the best level the CPU supports;
+static int supportedLevel(){
+#ifdef SCORE_KERNEL_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		return SCORE_KERNEL_AVX2;
+	}
+	if(__builtin_cpu_supports("sse")){
+		return SCORE_KERNEL_SSE;
+	}
+#endif
+	return SCORE_KERNEL_SCALAR;
+}
+
+const ScoreKernels *scoreKernels(int level){
+	static const int supported = supportedLevel();
+	if(level > supported){
+		level = supported;
+	}
+	if(level < SCORE_KERNEL_SCALAR){
+		level = SCORE_KERNEL_SCALAR;
+	}
+	return &kernelLevels[level];
+}
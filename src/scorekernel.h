@@ -0,0 +1,50 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#ifndef _SCOREKERNEL_H_
+#define _SCOREKERNEL_H_
+
+#include <stddef.h>
+#include "globals.h"
+
+using namespace std;
+
+// The arithmetic of likelihoodCal over the hits of a query sequence, whose
+// dual histogram and substitution matrix values are stored three per hit
+// (phylum, genus, species), and over the scores of the taxa of one rank.
+// Each kernel comes in a scalar, an SSE and an AVX2 version; the best one
+// the CPU supports is picked at run time. They all do the same float
+// operations on each value, so their results are identical.
+
+#define SCORE_KERNEL_SCALAR 0
+#define SCORE_KERNEL_SSE 1
+#define SCORE_KERNEL_AVX2 2
+#define SCORE_KERNEL_BEST 2
+
+struct scoreKernels_st{
+	int level;
+	const char *name;
+
+	// scores[i] = weights1[i % 3] * dualHist[i] + weights2[i % 3] * subMTX[i]
+	// for the 3 * numHits values of a run of hits;
+	void (*weightHitScores)(const float *dualHist, const float *subMTX, size_t numHits,
+							const float *weights1, const float *weights2, float *scores);
+
+	// scores[i] = dualHist[i] + subMTX[i], weightHitScores() with all weights
+	// 1, whose results are the same;
+	void (*addHitScores)(const float *dualHist, const float *subMTX, size_t numHits, float *scores);
+
+	// divide the n scores by sum, or set them to 1 if sum is 0; returns the
+	// index of the first of the highest results above 0, or n if none is;
+	size_t (*normalizeScores)(float *scores, size_t n, float sum);
+};
+
+// the kernels of the given level, or of the best level below it that the
+// CPU supports;
+const ScoreKernels *scoreKernels(int level = SCORE_KERNEL_BEST);
+
+#endif
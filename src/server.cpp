@@ -0,0 +1,274 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <csignal>
+#include <climits>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "algo.h"
+#include "taxonomy.h"
+#include "globals.h"
+
+using namespace std;
+
+// longest request line accepted, two paths and a cutoff;
+#define MAX_REQUEST (2 * PATH_MAX + 64)
+
+static mutex logMutex;
+static const char *servedSocket = NULL;
+
+// the scoring parameters of all jobs, given to serveJobs();
+static ScoreWeights servedWeights;
+static HitFilter servedFilter;
+static LCAIndex *servedLCAIndex = NULL;     // set for --mode lca
+
+static void logLine(const string &message){
+	lock_guard<mutex> lock(logMutex);
+	cout << message << endl;
+}
+
+// remove the socket file when the server is killed;
+static void removeSocket(int sig){
+	if(servedSocket != NULL){
+		unlink(servedSocket);
+	}
+	_exit(128 + sig);
+}
+
+static bool fillSocketAddress(const char *socketPath, struct sockaddr_un *addr){
+	if(strlen(socketPath) >= sizeof(addr->sun_path)){
+		cerr << "Socket path too long: " << socketPath << endl;
+		return false;
+	}
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, socketPath);
+	return true;
+}
+
+static bool writeAll(int fd, const string &data){
+	size_t done = 0;
+	while(done < data.size()){
+		ssize_t written = write(fd, data.c_str() + done, data.size() - done);
+		if(written <= 0){
+			return false;
+		}
+		done += written;
+	}
+	return true;
+}
+
+// read up to the first newline, which is dropped; false on EOF or overflow;
+static bool readLine(int fd, string &line){
+	char buffer[4096];
+	line.clear();
+	while(line.size() < MAX_REQUEST){
+		ssize_t numRead = read(fd, buffer, sizeof(buffer));
+		if(numRead <= 0){
+			return false;
+		}
+		line.append(buffer, numRead);
+		size_t newline = line.find('\n');
+		if(newline != string::npos){
+			line.resize(newline);
+			return true;
+		}
+	}
+	return false;
+}
+
+// classify one job against the resident database, returns the answer line;
+static string runJob(const string &request, TaxonTree *tTree, TaxonName *sciName, DBImage *dbImage){
+	vector<string> fields = split(request, '\t');
+	if(fields.size() != 3 && fields.size() != 4){
+		return "ERROR malformed request";
+	}
+	const char *inputFile = fields[0].c_str();
+	const char *outputFile = fields[1].c_str();
+	float scoreThr = atof(fields[2].c_str());
+	// the client's limit, if it sent one, replaces that of serve;
+	HitFilter filter = servedFilter;
+	if(fields.size() == 4){
+		filter.maxHitsPerGene = atoi(fields[3].c_str());
+	}
+
+	// unreadable, undecodable or truncated inputs fail the job, not the server;
+	string error;
+	QueryReader *reader = openQueryReader(inputFile, NULL, &filter, &error);
+	if(reader == NULL){
+		return "ERROR " + error;
+	}
+	// the results go to a file next to the output, renamed over it once the
+	// job succeeds, so that a failed job leaves no output behind;
+	string tmpFile = fields[1] + ".tmp";
+	ofstream output(tmpFile.c_str(), ios::out);
+	if(!output){
+		closeQueryReader(reader);
+		return "ERROR cannot write output file " + fields[1];
+	}
+
+	// read, scored and written a window at a time, as a --stream run;
+	QueryBatch QuerySeq;
+	while(readQuerySequences(reader, QuerySeq, STREAM_WINDOW) > 0){
+		loadGI2TaxonLibFromImage(dbImage, QuerySeq);
+		loadGI2ClstrLibFromImage(dbImage, QuerySeq);
+		if(servedLCAIndex != NULL){
+			lcaCal(servedLCAIndex, QuerySeq);
+		}else{
+			likelihoodCal(tTree, QuerySeq, 1, &servedWeights);
+		}
+		writeResults(output, tTree, sciName, QuerySeq, scoreThr);
+		clearQueryBatch(QuerySeq);
+	}
+	error = queryReaderError(reader);
+	closeQueryReader(reader);
+	output.close();
+	if(error.empty() && (output.fail() || rename(tmpFile.c_str(), outputFile) != 0)){
+		error = "cannot write output file " + fields[1];
+	}
+	if(!error.empty()){
+		unlink(tmpFile.c_str());
+		return "ERROR " + error;
+	}
+	return "OK";
+}
+
+static void serveClient(int fd, TaxonTree *tTree, TaxonName *sciName, DBImage *dbImage){
+	string request;
+	if(readLine(fd, request)){
+		logLine("Job started: " + request);
+		string answer = runJob(request, tTree, sciName, dbImage);
+		logLine("Job finished: " + request + ": " + answer);
+		writeAll(fd, answer + "\n");
+	}
+	close(fd);
+}
+
+// one of the workers of serveJobs(): runs the jobs of the connections it
+// accepts, one at a time, until accepting fails;
+static void acceptJobs(int fd, TaxonTree *tTree, TaxonName *sciName, DBImage *dbImage){
+	while(true){
+		int client = accept(fd, NULL, NULL);
+		if(client < 0){
+			if(errno == EINTR || errno == ECONNABORTED){
+				continue;
+			}
+			if(errno != EINVAL){
+				logLine(string("Could not accept connection: ") + strerror(errno));
+			}
+			return;
+		}
+		serveClient(client, tTree, sciName, dbImage);
+	}
+}
+
+int serveJobs(const char *socketPath, TaxonTree *tTree, TaxonName *sciName, DBImage *dbImage,
+				const ScoreWeights *weights, const HitFilter *filter, LCAIndex *lcaIndex, int numThreads){
+	servedWeights = *weights;
+	servedFilter = *filter;
+	servedLCAIndex = lcaIndex;
+	struct sockaddr_un addr;
+	if(!fillSocketAddress(socketPath, &addr)){
+		return 1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0){
+		cerr << "Could not create socket: " << strerror(errno) << endl;
+		return 1;
+	}
+
+	// a socket file nobody answers on is left over from a killed server;
+	if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0){
+		cerr << "Another MyTaxa server is already running on " << socketPath << endl;
+		close(fd);
+		return 1;
+	}
+	close(fd);
+	unlink(socketPath);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0){
+		cerr << "Could not listen on " << socketPath << ": " << strerror(errno) << endl;
+		return 1;
+	}
+	servedSocket = socketPath;
+	signal(SIGINT, removeSocket);
+	signal(SIGTERM, removeSocket);
+	signal(SIGPIPE, SIG_IGN);
+	logLine(string("Serving jobs on ") + socketPath);
+
+	// numThreads workers accept and run the jobs, the other connections
+	// wait in the listen queue; once one worker fails, the others are woken
+	// up by the shutdown and stop too;
+	vector<thread> workers;
+	for(int worker = 1; worker < numThreads; worker++){
+		workers.push_back(thread(acceptJobs, fd, tTree, sciName, dbImage));
+	}
+	acceptJobs(fd, tTree, sciName, dbImage);
+	shutdown(fd, SHUT_RDWR);
+	for(unsigned int worker = 0; worker < workers.size(); worker++){
+		workers[worker].join();
+	}
+	close(fd);
+	unlink(socketPath);
+	return 1;
+}
+
+int submitJob(const char *socketPath, const char *inputFile, const char *outputFile, float scoreThr, unsigned int maxHitsPerGene){
+	struct sockaddr_un addr;
+	if(!fillSocketAddress(socketPath, &addr)){
+		return 1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0){
+		cerr << "Could not connect to a MyTaxa server on " << socketPath << ": " << strerror(errno) << endl;
+		return 1;
+	}
+
+	// the server does not share our working directory;
+	string output = outputFile;
+	if(output[0] != '/'){
+		char cwd[PATH_MAX];
+		if(getcwd(cwd, sizeof(cwd)) == NULL){
+			cerr << "Could not resolve output file: " << outputFile << endl;
+			return 1;
+		}
+		output = string(cwd) + "/" + output;
+	}
+	ostringstream request;
+	request.precision(9);
+	request << inputFile << '\t' << output << '\t' << scoreThr;
+	if(maxHitsPerGene > 0){
+		request << '\t' << maxHitsPerGene;
+	}
+	request << '\n';
+
+	string answer;
+	if(!writeAll(fd, request.str()) || !readLine(fd, answer)){
+		cerr << "Connection to the MyTaxa server was lost" << endl;
+		close(fd);
+		return 1;
+	}
+	close(fd);
+	if(answer != "OK"){
+		cerr << answer << endl;
+		return 1;
+	}
+	return 0;
+}
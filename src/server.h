@@ -0,0 +1,36 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include "globals.h"
+
+// "MyTaxa serve" keeps the taxonomy and the mapped database image resident
+// and classifies jobs sent by "MyTaxa client" over a Unix domain socket. A
+// job is one request line, "<input file>\t<output file>\t<score cutoff>\n",
+// optionally with a fourth field, the hits kept per gene; it is answered by
+// "OK\n" or "ERROR <reason>\n" once its output is written. A fixed number of
+// jobs run concurrently, each on its own thread, against the read-only
+// database, with the model, scoring weights and hit filters the server was
+// started with; each reads, scores and writes its input a window of query
+// sequences at a time.
+
+#define SERVE_SOCKET_NAME "MyTaxa.sock"
+
+// serve jobs on socketPath, numThreads at once, until killed; returns
+// non-zero if the socket cannot be set up; a job that gives the hits kept
+// per gene overrides that of filter; jobs are classified by LCA if lcaIndex
+// is not NULL;
+int serveJobs(const char *socketPath, TaxonTree *tTree, TaxonName *sciName, DBImage *dbImage,
+				const ScoreWeights *weights, const HitFilter *filter, LCAIndex *lcaIndex, int numThreads);
+
+// send one job and wait for its answer; returns 0 if the job succeeded;
+// maxHitsPerGene 0 keeps all hits;
+int submitJob(const char *socketPath, const char *inputFile, const char *outputFile, float scoreThr, unsigned int maxHitsPerGene);
+
+#endif
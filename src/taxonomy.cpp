@@ -6,9 +6,10 @@
 */
 
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <string>
-#include <sstream>
+#include <cctype>
 #include <map>
 #include <vector>
 
@@ -16,20 +17,25 @@
 #include "utility.h"
 #include "globals.h"
 #include "algo.h"
+#include "dbimage.h"
+#include "textscan.h"
 
 using namespace std;
 
 
 // initializers and destroyers
 
-TaxonNode *newTaxonNode(){
-	TaxonNode *tNode = callocOrExit(1, TaxonNode);
-	return tNode;
-}
-
 TaxonTree *newTaxonTree(){
+	static const char *fixedRanks[NUM_FIXED_RANKS] = {
+		"", "no rank", "superkingdom", "phylum", "class", "order", "family", "genus", "species"
+	};
+	
 	TaxonTree *tTree = callocOrExit(1, TaxonTree);
-	tTree->nodes.clear();
+	for(int code = 0; code < NUM_FIXED_RANKS; code++){
+		tTree->rankNames[code] = strdup(fixedRanks[code]);
+	}
+	tTree->numRanks = NUM_FIXED_RANKS;
+	tTree->mapped = false;
 	return tTree;
 }
 
@@ -38,16 +44,22 @@ void destroyTaxonTree(TaxonTree *tTree){
 		return;
 	}
 	
-	if(tTree->nodes.size() != 0){
-		tTree->nodes.clear();
+	if(!tTree->mapped){
+		free(tTree->parent);
+		free(tTree->rank);
+		free(tTree->lineage);
+		for(int code = 0; code < tTree->numRanks; code++){
+			free((char *) tTree->rankNames[code]);
+		}
 	}
+	free(tTree->intervals);
 	
 	free(tTree);
 }
 
 TaxonName *newTaxonName(){
 	TaxonName *tName = callocOrExit(1, TaxonName);
-	tName->names.clear();
+	tName->maxTaxonID = -1;
 	return tName;
 }
 
@@ -56,164 +68,363 @@ void destroyTaxonName(TaxonName *tName){
 		return;
 	}
 	
-	if(tName->names.size() != 0){
-		tName->names.clear();
+	if(!tName->mapped){
+		free(tName->offsets);
+		free(tName->arena);
 	}
 	
 	free(tName);
 }
 
-TaxonNode *taxonNodeInTaxonTree(TaxonTree *tTree, IDnum taxonID){
-	try{
-		return tTree->nodes[taxonID];
-	}catch(...){
-		return NULL;
+// grow the dense arrays so that taxonID is a valid index;
+static void reserveTaxonID(TaxonTree *tTree, IDnum taxonID){
+	if(taxonID <= tTree->maxTaxonID){
+		return;
 	}
+	
+	IDnum oldSize = (tTree->parent == NULL)?0:tTree->maxTaxonID + 1;
+	IDnum newSize = (oldSize == 0)?1024:oldSize;
+	while(newSize <= taxonID){
+		newSize *= 2;
+	}
+	
+	tTree->parent = reallocOrExit(tTree->parent, newSize, IDnum);
+	tTree->rank = reallocOrExit(tTree->rank, newSize, RankCode);
+	memset(tTree->parent + oldSize, 0, (newSize - oldSize) * sizeof(IDnum));
+	memset(tTree->rank + oldSize, 0, (newSize - oldSize) * sizeof(RankCode));
+	tTree->maxTaxonID = newSize - 1;
 }
 
-void addNodeToTaxonTree(TaxonTree *tTree, IDnum nodeIDnum, 
-				IDnum prevNodeIDnum, char *rank){
-	
-	TaxonNode *currentNode = taxonNodeInTaxonTree(tTree, nodeIDnum);
-	TaxonNode *prevNode = taxonNodeInTaxonTree(tTree, prevNodeIDnum);
+// code of a rank name, interning it if it is new;
+static RankCode internRank(TaxonTree *tTree, const char *rank){
+	for(int code = 1; code < tTree->numRanks; code++){
+		if(strcmp(tTree->rankNames[code], rank) == 0){
+			return code;
+		}
+	}
 	
-	if(currentNode == NULL){
-		currentNode = newTaxonNode();
-		currentNode->taxonID = nodeIDnum;
-		currentNode->rank = rank;
-		tTree->nodes[nodeIDnum]=currentNode;	
+	if(tTree->numRanks == MAX_RANKS){
+		cerr << "Too many distinct ranks in NCBI taxonomy file, ignoring: " << rank << endl;
+		return RANK_NO_RANK;
 	}
+	tTree->rankNames[tTree->numRanks] = strdup(rank);
+	return tTree->numRanks++;
+}
 
+// the first rank seen for a node is kept, the last parent seen wins;
+void addNodeToTaxonTree(TaxonTree *tTree, IDnum nodeIDnum, 
+				IDnum prevNodeIDnum, RankCode rank){
 	
-	if(prevNode == NULL){
-		prevNode = newTaxonNode();
-		prevNode->taxonID = prevNodeIDnum;
-		tTree->nodes[prevNodeIDnum]=prevNode;
+	if(nodeIDnum <= 0 || prevNodeIDnum <= 0){
+		return;
 	}
+	reserveTaxonID(tTree, (nodeIDnum > prevNodeIDnum)?nodeIDnum:prevNodeIDnum);
 	
 	if(nodeIDnum != prevNodeIDnum){
-		tTree->nodes[nodeIDnum]->prevNode=tTree->nodes[prevNodeIDnum];
+		tTree->parent[nodeIDnum] = prevNodeIDnum;
+	}else if(tTree->parent[nodeIDnum] == 0){
+		tTree->parent[nodeIDnum] = nodeIDnum;
 	}
 	
-	if(currentNode->rank == NULL){
-		currentNode->rank = rank;
+	if(tTree->rank[nodeIDnum] == RANK_UNSET){
+		tTree->rank[nodeIDnum] = rank;
 	}
 }
 
-// function that reads taxonNodes lib from NCBI file
-TaxonTree *importTaxonTreeFromFile(const char* taxonTreeFile){
-	FILE *ncbiTaxonTreeFile = fopen(taxonTreeFile, "r");
+static IDnum parentOnPath(TaxonTree *tTree, IDnum taxonID);
+
+// fill lineage[] for every taxon, reusing the lineage of its parent;
+static void buildLineageTable(TaxonTree *tTree){
+	IDnum numTaxa = tTree->maxTaxonID + 1;
+	tTree->lineage = callocOrExit(numTaxa, TaxonLineage);
+	vector<char> done(numTaxa, 0);
+	vector<IDnum> pending;
+	
+	// the root is not part of any taxonomy path;
+	if(numTaxa > 1){
+		done[1] = 1;
+	}
 	
-	const int maxLine = 20000;
-	char line[maxLine];
-	IDnum currentNode;
-	IDnum prevNode;
-	char *rank;
+	for(IDnum taxonID = 1; taxonID < numTaxa; taxonID++){
+		if(done[taxonID] || !taxonInTree(tTree, taxonID)){
+			continue;
+		}
+		
+		// climb to the first node with a known lineage, then fill downwards;
+		pending.clear();
+		IDnum current = taxonID;
+		while(current != 0 && !done[current]){
+			pending.push_back(current);
+			current = parentOnPath(tTree, current);
+		}
+		
+		for(int index = pending.size() - 1; index >= 0; index--){
+			IDnum node = pending[index];
+			IDnum parent = parentOnPath(tTree, node);
+			TaxonLineage &lineage = tTree->lineage[node];
+			if(parent != 0){
+				lineage = tTree->lineage[parent];
+			}
+			if(tTree->rank[node] == RANK_PHYLUM && lineage.phylum == 0){
+				lineage.phylum = node;
+			}else if(tTree->rank[node] == RANK_GENUS && lineage.genus == 0){
+				lineage.genus = node;
+			}else if(tTree->rank[node] == RANK_SPECIES && lineage.species == 0){
+				lineage.species = node;
+			}
+			done[node] = 1;
+		}
+	}
+}
+
+// next whitespace delimited word of [p, end), as operator>> reads it;
+static const char *nextWord(const char *p, const char *end, const char **wordEnd){
+	while(p < end && isspace((unsigned char) *p)){
+		p++;
+	}
+	const char *q = p;
+	while(q < end && !isspace((unsigned char) *q)){
+		q++;
+	}
+	*wordEnd = q;
+	return p;
+}
+
+// function that reads taxonNodes lib from NCBI file: <taxonID> <parent> <rank>,
+// where the rank is one or two words;
+TaxonTree *importTaxonTreeFromFile(const char* taxonTreeFile){
+	LineReader *ncbiTaxonTreeFile = openLineReader(taxonTreeFile);
+	TaxonTree *tTree = importTaxonTreeFromReader(ncbiTaxonTreeFile);
+	closeLineReader(ncbiTaxonTreeFile);
+	return tTree;
+}
+
+TaxonTree *importTaxonTreeFromReader(LineReader *ncbiTaxonTreeFile){
+	const char *line;
+	size_t length;
+	string rank;
 	
 	TaxonTree *tTree = newTaxonTree();
 	
-//	cout << "Now reading NCBI taxonomy file: " << taxonFile << endl;
-	if (ncbiTaxonTreeFile == NULL){
-		cerr << "Could not open input NCBI taxonomy file: " << taxonTreeFile << endl;
-		exit(EXIT_FAILURE);
-	}
-	
-	while(fgets(line, maxLine, ncbiTaxonTreeFile) != NULL){
-		string tmpA, tmpB, tmpRank;		
-		stringstream streamLine;
-		streamLine << line;
-		try{
-			streamLine >> currentNode >> prevNode >> tmpA >> tmpB;
-			if(tmpB.empty()){
-				tmpRank = tmpA;
-			}else{
-				tmpRank = tmpA + string(" ") + tmpB;
-			}
-			rank = new char[tmpRank.size()+1];
-			copy(tmpRank.begin(), tmpRank.end(), rank);
-			rank[tmpRank.size()] = '\0';
-		}catch(...){
-			streamLine >> currentNode >> prevNode >> tmpA;
-			rank = new char[tmpA.size()];
-			copy(tmpA.begin(), tmpA.end(), rank);
-			rank[tmpA.size()] = '\0';
+	while(readLine(ncbiTaxonTreeFile, &line, &length)){
+		const char *end = line + length;
+		long currentNode, prevNode;
+		const char *p = parseIntField(line, end, &currentNode);
+		if(p == NULL || (p = parseIntField(p, end, &prevNode)) == NULL){
+			continue;
 		}
-
-		addNodeToTaxonTree(tTree, currentNode, prevNode, rank);
+		const char *wordEnd;
+		const char *word = nextWord(p, end, &wordEnd);
+		rank.assign(word, wordEnd - word);
+		word = nextWord(wordEnd, end, &wordEnd);
+		if(word != wordEnd){
+			rank.append(" ");
+			rank.append(word, wordEnd - word);
+		}
+		
+		addNodeToTaxonTree(tTree, currentNode, prevNode, internRank(tTree, rank.c_str()));
 	}
 	
-	fclose(ncbiTaxonTreeFile);
+	buildLineageTable(tTree);
 	
 	return tTree;
 }
 
-TaxonName *importTaxonNameFromFile(const char* taxonNameFile){
-	FILE *ncbiTaxonNameFile = fopen(taxonNameFile, "r");
+// store a name unless taxonID already has one (the first name listed wins);
+static void addTaxonName(TaxonName *tName, IDnum taxonID, const char *name, size_t length){
+	if(taxonID < 0){
+		return;
+	}
+	if(taxonID > tName->maxTaxonID){
+		IDnum oldSize = tName->maxTaxonID + 1;
+		IDnum newSize = (oldSize == 0)?1024:oldSize;
+		while(newSize <= taxonID){
+			newSize *= 2;
+		}
+		tName->offsets = reallocOrExit(tName->offsets, newSize, uint32_t);
+		memset(tName->offsets + oldSize, 0xFF, (newSize - oldSize) * sizeof(uint32_t));
+		tName->maxTaxonID = newSize - 1;
+	}
+	if(tName->offsets[taxonID] != NO_NAME){
+		return;
+	}
 	
-	const int maxLine = 5000;
-	char line[maxLine];
-	IDnum taxonID;
-	string taxonName;
-	char delim = '\t';
+	if(tName->arenaSize + length + 1 > tName->arenaAllocated){
+		size_t newSize = (tName->arenaAllocated == 0)?65536:tName->arenaAllocated;
+		while(tName->arenaSize + length + 1 > newSize){
+			newSize *= 2;
+		}
+		tName->arena = reallocOrExit(tName->arena, newSize, char);
+		tName->arenaAllocated = newSize;
+	}
+	tName->offsets[taxonID] = tName->arenaSize;
+	memcpy(tName->arena + tName->arenaSize, name, length);
+	tName->arena[tName->arenaSize + length] = '\0';
+	tName->arenaSize += length + 1;
+}
+
+// read ncbiSciNames.lib (<taxonID>\t<name>), keeping the names of the taxa
+// flagged in wanted, or all of them if wanted is NULL;
+static void readTaxonNames(TaxonName *tName, LineReader *ncbiTaxonNameFile, const vector<char> *wanted){
+	const char *line;
+	size_t length;
+	
+	while(readLine(ncbiTaxonNameFile, &line, &length)){
+		const char *end = line + length;
+		long taxonID;
+		if(parseIntField(line, end, &taxonID) == NULL){
+			taxonID = 0;
+		}
+		if(wanted != NULL && (taxonID < 0 || taxonID >= (IDnum) wanted->size() || !(*wanted)[taxonID])){
+			continue;
+		}
+		const char *name = (const char *) memchr(line, '\t', length);
+		if(name == NULL){
+			continue;
+		}
+		name++;
+		const char *nameEnd = (const char *) memchr(name, '\t', end - name);
+		addTaxonName(tName, taxonID, name, ((nameEnd == NULL)?end:nameEnd) - name);
+	}
+}
+
+TaxonName *importTaxonNameFromFile(const char* taxonNameFile){
+	LineReader *ncbiTaxonNameFile = openLineReader(taxonNameFile);
+	TaxonName *tName = importTaxonNameFromReader(ncbiTaxonNameFile);
+	closeLineReader(ncbiTaxonNameFile);
+	return tName;
+}
+
+TaxonName *importTaxonNameFromReader(LineReader *ncbiTaxonNameFile){
+	TaxonName *tName = newTaxonName();
+	readTaxonNames(tName, ncbiTaxonNameFile, NULL);
+	return tName;
+}
+
+TaxonName *openTaxonNameFile(const char* taxonNameFile){
 	TaxonName *tName = newTaxonName();
+	tName->sourceFile = taxonNameFile;
+	return tName;
+}
+
+void loadTaxonNames(TaxonName *tName, const vector<IDnum> &taxonIDs){
+	if(tName->sourceFile == NULL){
+		return;
+	}
 	
-	if (ncbiTaxonNameFile == NULL){
-		cerr << "Could not open input NCBI taxonomy file: " << taxonNameFile << endl;
-		exit(EXIT_FAILURE);
+	IDnum maxWanted = -1;
+	for(unsigned int index = 0; index < taxonIDs.size(); index++){
+		if(taxonIDs[index] > maxWanted && taxonName(tName, taxonIDs[index])[0] == '\0'){
+			maxWanted = taxonIDs[index];
+		}
+	}
+	if(maxWanted < 0){
+		return;
 	}
 	
+	vector<char> wanted(maxWanted + 1, 0);
+	for(unsigned int index = 0; index < taxonIDs.size(); index++){
+		if(taxonIDs[index] >= 0 && taxonIDs[index] <= maxWanted){
+			wanted[taxonIDs[index]] = 1;
+		}
+	}
+	LineReader *ncbiTaxonNameFile = openLineReader(tName->sourceFile);
+	readTaxonNames(tName, ncbiTaxonNameFile, &wanted);
+	closeLineReader(ncbiTaxonNameFile);
+}
+
+const char *taxonName(TaxonName *tName, IDnum taxonID){
+	if(taxonID < 0 || taxonID > tName->maxTaxonID || tName->offsets[taxonID] == NO_NAME){
+		return "";
+	}
+	return tName->arena + tName->offsets[taxonID];
+}
+
+// load the tree from a compiled database image; the dense arrays, lineage table and rank
+// names are used in place, so this takes constant time;
+TaxonTree *importTaxonTreeFromImage(DBImage *image){
+	uint64_t parentSize, rankSize, lineageSize, namesSize;
+	const IDnum *parent = (const IDnum *) dbImageSection(image, DB_SECT_TREE, &parentSize);
+	const RankCode *rank = (const RankCode *) dbImageSection(image, DB_SECT_TREE_RANKS, &rankSize);
+	const TaxonLineage *lineage = (const TaxonLineage *) dbImageSection(image, DB_SECT_TREE_LINEAGE, &lineageSize);
+	const char *rankNames = (const char *) dbImageSection(image, DB_SECT_RANKS, &namesSize);
 	
-	while(fgets(line, maxLine, ncbiTaxonNameFile) != NULL){
-		vector<string> elems = split(string(line), delim);
-		taxonName = elems[1];
-		taxonID = atoi(elems[0].c_str());
-		
-		map<IDnum, string>::iterator it;
-		it = tName->names.begin();
-		tName->names.insert(it, pair<IDnum, string>(taxonID, taxonName));
+	TaxonTree *tTree = callocOrExit(1, TaxonTree);
+	tTree->mapped = true;
+	tTree->maxTaxonID = parentSize / sizeof(IDnum) - 1;
+	tTree->parent = (IDnum *) parent;
+	tTree->rank = (RankCode *) rank;
+	tTree->lineage = (TaxonLineage *) lineage;
+	
+	for(const char *p = rankNames; p < rankNames + namesSize && tTree->numRanks < MAX_RANKS; p += strlen(p) + 1){
+		tTree->rankNames[tTree->numRanks++] = p;
 	}
 	
-	fclose(ncbiTaxonNameFile);
+	return tTree;
+}
+
+// the offset table and the arena are used in place, pages are only read for
+// the names that are looked up;
+TaxonName *importTaxonNameFromImage(DBImage *image){
+	uint64_t offsetsSize, poolSize;
+	const uint32_t *offsets = (const uint32_t *) dbImageSection(image, DB_SECT_NAMES, &offsetsSize);
+	const char *pool = (const char *) dbImageSection(image, DB_SECT_NAME_POOL, &poolSize);
+	
+	TaxonName *tName = newTaxonName();
+	tName->mapped = true;
+	tName->maxTaxonID = offsetsSize / sizeof(uint32_t) - 1;
+	tName->offsets = (uint32_t *) offsets;
+	tName->arena = (char *) pool;
+	tName->arenaSize = poolSize;
 	
 	return tName;
 }
 
 // some operational functions
-bool isRoot(TaxonNode* tNode){
-	if(tNode->taxonID == 1){
-		return true;
-	}else{
-		return false;
+bool taxonInTree(TaxonTree *tTree, IDnum taxonID){
+	return taxonID > 0 && taxonID <= tTree->maxTaxonID && tTree->parent[taxonID] != 0;
+}
+
+const char *rankName(TaxonTree *tTree, RankCode rank){
+	if(rank >= tTree->numRanks){
+		return "";
 	}
+	return tTree->rankNames[rank];
+}
+
+// next node on the way to the root, 0 once the root (1) or a broken chain is reached;
+static IDnum parentOnPath(TaxonTree *tTree, IDnum taxonID){
+	IDnum parent = tTree->parent[taxonID];
+	if(taxonID == 1 || parent == taxonID || !taxonInTree(tTree, parent)){
+		return 0;
+	}
+	return parent;
+}
+
+const TaxonLineage *taxonLineage(TaxonTree *tTree, IDnum taxonID){
+	static const TaxonLineage noLineage = {0, 0, 0};
+	if(!taxonInTree(tTree, taxonID)){
+		return &noLineage;
+	}
+	return &tTree->lineage[taxonID];
 }
 
 // output the taxonomy path in a vector<NameRank>, given a taxonID;
 vector<NameRank> taxonomyPath(TaxonTree *tTree, TaxonName *tNames, IDnum taxonID){
 	vector<NameRank> taxonPath;
 	NameRank nr;
-	TaxonNode *startNode = newTaxonNode();
-	TaxonNode *currentNode = newTaxonNode();
 	
-	try{
-		startNode = tTree->nodes[taxonID];
-	}catch(...){
+	if(!taxonInTree(tTree, taxonID)){
 		cout << "taxonID: " << taxonID << " not found in database"<< endl;
+		return taxonPath;
 	}
 	
 	// visit every node from leaf to root;
-	try{
-		currentNode = startNode; 
-		while(!isRoot(currentNode)){
-			IDnum currentTaxonID = currentNode->taxonID;
-			string name = tNames->names[currentTaxonID];
-			char *rank = tTree->nodes[currentTaxonID]->rank;
-			nr.name = name;
-			nr.rank = string(rank);
-			taxonPath.push_back(nr);
-			currentNode = currentNode->prevNode;
-		}
-	}catch(...){
-		cout << "taxonID : " << currentNode->taxonID << " not found"<<endl;
+	for(IDnum currentTaxonID = taxonID; currentTaxonID != 0 && currentTaxonID != 1;
+			currentTaxonID = parentOnPath(tTree, currentTaxonID)){
+		nr.name = taxonName(tNames, currentTaxonID);
+		nr.rank = string(rankName(tTree, tTree->rank[currentTaxonID]));
+		taxonPath.push_back(nr);
 	}
 	
 	return taxonPath;
@@ -223,31 +434,17 @@ vector<NameRank> taxonomyPath(TaxonTree *tTree, TaxonName *tNames, IDnum taxonID
 vector<IDRank> taxonomyPathIDRank(TaxonTree *tTree, IDnum taxonID){
 	vector<IDRank> taxonPath;
 	IDRank idr;
-	TaxonNode *currentNode = newTaxonNode();
-	
-	try{
-		currentNode = tTree->nodes[taxonID];
-	}catch(...){
-		cout << "taxonID: " << taxonID << " not found in database"<< endl;
-	}
-	
 	
-	// visit every node from leaf to root;
-	if(currentNode == NULL){
+	if(!taxonInTree(tTree, taxonID)){
 		return taxonPath;
 	}
 	
-	try{
-		while(!isRoot(currentNode)){
-			IDnum currentTaxonID = currentNode->taxonID;
-			char *rank = tTree->nodes[currentTaxonID]->rank;
-			idr.taxonID = currentTaxonID;
-			idr.rank = string(rank);
-			taxonPath.push_back(idr);
-			currentNode = currentNode->prevNode;
-		}
-	}catch(...){
-		cout << "taxonID : " << currentNode->taxonID << " not found"<<endl;
+	// visit every node from leaf to root;
+	for(IDnum currentTaxonID = taxonID; currentTaxonID != 0 && currentTaxonID != 1;
+			currentTaxonID = parentOnPath(tTree, currentTaxonID)){
+		idr.taxonID = currentTaxonID;
+		idr.rank = tTree->rank[currentTaxonID];
+		taxonPath.push_back(idr);
 	}
 	
 	return taxonPath;
@@ -257,25 +454,14 @@ vector<IDRank> taxonomyPathIDRank(TaxonTree *tTree, IDnum taxonID){
 vector<IDnum> taxonomyPath(TaxonTree *tTree, IDnum taxonID){
 	vector<IDnum> taxonPath;
 	
-	TaxonNode *startNode = newTaxonNode();
-	TaxonNode *currentNode = newTaxonNode();
-	
-	try{
-		startNode = tTree->nodes[taxonID];
-	}catch(...){
-		cout << "taxonID: " << taxonID << " not found in database"<< endl;
+	if(!taxonInTree(tTree, taxonID)){
+		return taxonPath;
 	}
 	
 	// visit every node from leaf to root;
-	try{
-		currentNode = startNode; 
-		while(!isRoot(currentNode)){
-			IDnum currentTaxonID = currentNode->taxonID;
-			taxonPath.push_back(currentTaxonID);
-			currentNode = currentNode->prevNode;
-		}
-	}catch(...){
-		cout << "taxonID : " << currentNode->taxonID << " not found"<<endl;
+	for(IDnum currentTaxonID = taxonID; currentTaxonID != 0 && currentTaxonID != 1;
+			currentTaxonID = parentOnPath(tTree, currentTaxonID)){
+		taxonPath.push_back(currentTaxonID);
 	}
 	
 	return taxonPath;
@@ -287,9 +473,9 @@ string taxonomyPathString(vector<NameRank> path){
 	for(int index = path.size()-1; index >= 0; index--){
 		NameRank node = path[index];
 		if(node.rank.find("no rank") == string::npos){
-			tmpString += "<" + node.rank + ">" + node.name.substr(0, node.name.size()-1) + ";";
+			tmpString += "<" + node.rank + ">" + node.name + ";";
 		}else if(node.rank.find("group") != string::npos){
-			tmpString += node.name.substr(0, node.name.size()-1) + ";";
+			tmpString += node.name + ";";
 		}
 	}
 	
@@ -320,3 +506,234 @@ IDnum lowestCommonAncestor(TaxonTree *tTree, IDnum taxonIDA, IDnum taxonIDB){
 
 
 
+////////////////////////// PREORDER ////////////////////////
+
+// the taxa of the tree as taxonomyPath() sees it, in preorder from the root
+// (1), children by increasing taxonID, and parentOf[] each one's parent
+// there; taxa whose path to the root is broken hang off the root, taxa on
+// cycles are never reached and left out;
+static void preorderTaxa(TaxonTree *tTree, IDnum numTaxa, vector<IDnum> &order, vector<IDnum> &parentOf){
+	parentOf.assign(numTaxa, 0);
+	vector<int32_t> firstChild(numTaxa + 1, 0);
+	for(IDnum taxonID = 2; taxonID < numTaxa; taxonID++){
+		if(taxonID <= tTree->maxTaxonID && taxonInTree(tTree, taxonID)){
+			IDnum parent = parentOnPath(tTree, taxonID);
+			parentOf[taxonID] = (parent == 0)?1:parent;
+			firstChild[parentOf[taxonID]]++;
+		}
+	}
+	int32_t numChildren = 0;
+	for(IDnum taxonID = 0; taxonID <= numTaxa; taxonID++){
+		int32_t count = (taxonID < numTaxa)?firstChild[taxonID]:0;
+		firstChild[taxonID] = numChildren;
+		numChildren += count;
+	}
+	vector<IDnum> children(numChildren);
+	vector<int32_t> filled(firstChild.begin(), firstChild.end() - 1);
+	for(IDnum taxonID = 2; taxonID < numTaxa; taxonID++){
+		if(parentOf[taxonID] != 0){
+			children[filled[parentOf[taxonID]]++] = taxonID;
+		}
+	}
+	
+	order.clear();
+	order.reserve(numChildren + 1);
+	vector<IDnum> stack(1, 1);
+	while(!stack.empty()){
+		IDnum taxonID = stack.back();
+		stack.pop_back();
+		order.push_back(taxonID);
+		for(int32_t child = firstChild[taxonID + 1] - 1; child >= firstChild[taxonID]; child--){
+			stack.push_back(children[child]);
+		}
+	}
+}
+
+// a descendant comes after its taxon in preorder, so walking the preorder
+// backwards finishes the interval of a taxon before it widens its parent's;
+void labelTaxonTree(TaxonTree *tTree){
+	if(tTree->intervals != NULL){
+		return;
+	}
+	IDnum numTaxa = (tTree->maxTaxonID > 1)?tTree->maxTaxonID + 1:2;
+	vector<IDnum> order, parentOf;
+	preorderTaxa(tTree, numTaxa, order, parentOf);
+	
+	TaxonInterval *intervals = mallocOrExit(numTaxa, TaxonInterval);
+	for(IDnum taxonID = 0; taxonID < numTaxa; taxonID++){
+		intervals[taxonID].first = -1;
+		intervals[taxonID].last = -1;
+	}
+	for(int32_t pos = 0; pos < (int32_t) order.size(); pos++){
+		intervals[order[pos]].first = pos;
+		intervals[order[pos]].last = pos;
+	}
+	for(int32_t pos = order.size() - 1; pos > 0; pos--){
+		TaxonInterval &parent = intervals[parentOf[order[pos]]];
+		if(intervals[order[pos]].last > parent.last){
+			parent.last = intervals[order[pos]].last;
+		}
+	}
+	tTree->intervals = intervals;
+}
+
+bool taxonUnder(const TaxonTree *tTree, IDnum taxonID, IDnum ancestorID){
+	if(taxonID <= 0 || taxonID > tTree->maxTaxonID || ancestorID <= 0 || ancestorID > tTree->maxTaxonID){
+		return false;
+	}
+	int32_t pos = tTree->intervals[taxonID].first;
+	const TaxonInterval &ancestor = tTree->intervals[ancestorID];
+	return pos >= 0 && ancestor.first <= pos && pos <= ancestor.last;
+}
+
+////////////////////////// LCA INDEX ////////////////////////
+
+// position of the shallowest taxon of [l, r], both in one block;
+static inline int32_t blockMinimum(const LCAIndex *index, int32_t l, int32_t r){
+	int32_t blockStart = r & ~63;
+	uint64_t mask = index->blockMasks[r] & (~0ULL << (l - blockStart));
+	return blockStart + __builtin_ctzll(mask);
+}
+
+static inline int32_t shallower(const LCAIndex *index, int32_t a, int32_t b){
+	return (index->depth[b] < index->depth[a])?b:a;
+}
+
+// position of the shallowest taxon of [l, r];
+static int32_t rangeMinimum(const LCAIndex *index, int32_t l, int32_t r){
+	int32_t blockL = l >> 6;
+	int32_t blockR = r >> 6;
+	if(blockL == blockR){
+		return blockMinimum(index, l, r);
+	}
+	int32_t best = shallower(index, blockMinimum(index, l, (blockL << 6) + 63), blockMinimum(index, blockR << 6, r));
+	if(blockL + 1 < blockR){
+		int level = 31 - __builtin_clz(blockR - blockL - 1);
+		const int32_t *row = index->blockTable + (size_t) level * index->numBlocks;
+		best = shallower(index, best, shallower(index, row[blockL + 1], row[blockR - (1 << level)]));
+	}
+	return best;
+}
+
+LCAIndex *buildLCAIndex(TaxonTree *tTree){
+	IDnum numTaxa = (tTree->maxTaxonID > 1)?tTree->maxTaxonID + 1:2;
+	LCAIndex *index = callocOrExit(1, LCAIndex);
+	index->maxTaxonID = numTaxa - 1;
+	index->position = mallocOrExit(numTaxa, int32_t);
+	
+	vector<IDnum> order, parentOf;
+	preorderTaxa(tTree, numTaxa, order, parentOf);
+	for(IDnum taxonID = 0; taxonID < numTaxa; taxonID++){
+		index->position[taxonID] = -1;
+	}
+	int32_t numPositions = order.size();
+	index->depth = mallocOrExit(numPositions, int32_t);
+	index->parent = mallocOrExit(numPositions, IDnum);
+	for(int32_t pos = 0; pos < numPositions; pos++){
+		IDnum taxonID = order[pos];
+		IDnum parent = (taxonID == 1)?0:parentOf[taxonID];
+		index->position[taxonID] = pos;
+		index->depth[pos] = (parent == 0)?0:index->depth[index->position[parent]] + 1;
+		index->parent[pos] = parent;
+	}
+	index->numPositions = numPositions;
+	
+	// within each block, the positions of the running minima up to every position;
+	index->blockMasks = mallocOrExit(numPositions, uint64_t);
+	for(int32_t blockStart = 0; blockStart < numPositions; blockStart += 64){
+		uint64_t minima = 0;
+		for(int32_t pos = blockStart; pos < numPositions && pos < blockStart + 64; pos++){
+			while(minima != 0 && index->depth[blockStart + 63 - __builtin_clzll(minima)] >= index->depth[pos]){
+				minima ^= 1ULL << (63 - __builtin_clzll(minima));
+			}
+			minima |= 1ULL << (pos - blockStart);
+			index->blockMasks[pos] = minima;
+		}
+	}
+	
+	// sparse table of the shallowest position of 2^level blocks;
+	int32_t numBlocks = (numPositions + 63) / 64;
+	int numLevels = 1;
+	while((1 << numLevels) <= numBlocks){
+		numLevels++;
+	}
+	index->numBlocks = numBlocks;
+	index->numLevels = numLevels;
+	index->blockTable = mallocOrExit((size_t) numLevels * numBlocks, int32_t);
+	for(int32_t block = 0; block < numBlocks; block++){
+		int32_t last = (block << 6) + 63;
+		index->blockTable[block] = blockMinimum(index, block << 6, (last < numPositions)?last:numPositions - 1);
+	}
+	for(int level = 1; level < numLevels; level++){
+		const int32_t *below = index->blockTable + (size_t) (level - 1) * numBlocks;
+		int32_t *row = index->blockTable + (size_t) level * numBlocks;
+		for(int32_t block = 0; block + (1 << level) <= numBlocks; block++){
+			row[block] = shallower(index, below[block], below[block + (1 << (level - 1))]);
+		}
+	}
+	return index;
+}
+
+void destroyLCAIndex(LCAIndex *index){
+	if(index == NULL){
+		return;
+	}
+	free(index->position);
+	free(index->depth);
+	free(index->parent);
+	free(index->blockMasks);
+	free(index->blockTable);
+	free(index);
+}
+
+static inline int32_t lcaPosition(const LCAIndex *index, IDnum taxonID){
+	return (taxonID > 0 && taxonID <= index->maxTaxonID)?index->position[taxonID]:-1;
+}
+
+IDnum lcaOfPair(const LCAIndex *index, IDnum taxonIDA, IDnum taxonIDB){
+	int32_t posA = lcaPosition(index, taxonIDA);
+	int32_t posB = lcaPosition(index, taxonIDB);
+	if(posA < 0 || posB < 0){
+		return 1;
+	}
+	if(posA == posB){
+		return taxonIDA;
+	}
+	if(posA > posB){
+		int32_t pos = posA;
+		posA = posB;
+		posB = pos;
+	}
+	return index->parent[rangeMinimum(index, posA + 1, posB)];
+}
+
+// the LCA of a set is that of its first and last taxa in preorder;
+IDnum lcaOfSet(const LCAIndex *index, const IDnum *taxonIDs, size_t numTaxa, size_t *numFound){
+	int32_t first = -1, last = -1;
+	IDnum firstTaxon = 0;
+	size_t found = 0;
+	for(size_t i = 0; i < numTaxa; i++){
+		int32_t pos = lcaPosition(index, taxonIDs[i]);
+		if(pos < 0){
+			continue;
+		}
+		found++;
+		if(first < 0 || pos < first){
+			first = pos;
+			firstTaxon = taxonIDs[i];
+		}
+		if(pos > last){
+			last = pos;
+		}
+	}
+	if(numFound != NULL){
+		*numFound = found;
+	}
+	if(found == 0){
+		return 0;
+	}
+	if(first == last){
+		return firstTaxon;
+	}
+	return index->parent[rangeMinimum(index, first + 1, last)];
+}
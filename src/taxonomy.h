@@ -14,12 +14,23 @@
 
 using namespace std;
 
-struct taxonNode_st {
-	IDnum taxonID;
-	taxonNode_st *prevNode;
-	char *rank;
+// rank codes; the common ranks have fixed codes, any other rank name found in
+// ncbiNodes.lib is interned after them;
+enum taxonRank_en {
+	RANK_UNSET = 0,     // taxon only seen as a parent
+	RANK_NO_RANK,
+	RANK_SUPERKINGDOM,
+	RANK_PHYLUM,
+	RANK_CLASS,
+	RANK_ORDER,
+	RANK_FAMILY,
+	RANK_GENUS,
+	RANK_SPECIES,
+	NUM_FIXED_RANKS
 };
 
+#define MAX_RANKS 256
+
 struct nameRank_st {
 	string name;
 	string rank;
@@ -27,20 +38,74 @@ struct nameRank_st {
 
 struct IDRank_st{
 	IDnum taxonID;
-	string rank;
+	RankCode rank;
+};
+
+// phylum, genus and species on the path of a taxon to the root, 0 where the
+// path has no node of that rank; of nested nodes of one rank the one closest
+// to the root is used;
+struct taxonLineage_st {
+	IDnum phylum;
+	IDnum genus;
+	IDnum species;
+};
+
+// preorder number of a taxon and of its last descendant, so that a taxon is
+// under another one, or is that one, when its number lies in the interval of
+// the other; -1 for taxa that are not in the tree;
+struct taxonInterval_st {
+	int32_t first;
+	int32_t last;
 };
 
+// dense tree indexed by taxonID: parent[id] is 0 for IDs that are not in
+// the tree, and the root (1) is its own parent. lineage[] is precomputed
+// once the tree is loaded, intervals[] by labelTaxonTree();
 struct taxonTree_st {
-	map<IDnum, TaxonNode*> nodes;
+	IDnum maxTaxonID;
+	IDnum *parent;
+	RankCode *rank;
+	TaxonLineage *lineage;
+	TaxonInterval *intervals;   // NULL until labelTaxonTree(), never mapped
+	const char *rankNames[MAX_RANKS];
+	int numRanks;
+	bool mapped;        // arrays and names live in a database image
 };
 
+// scientific names, stored back to back in an arena with an offset per
+// taxonID (NO_NAME where unknown). When sourceFile is set the names are
+// loaded lazily, by loadTaxonNames, for the taxa that are actually printed;
+#define NO_NAME 0xFFFFFFFFu
+
 struct taxonName_st {
-	map<IDnum, string> names;
+	IDnum maxTaxonID;
+	uint32_t *offsets;
+	char *arena;
+	size_t arenaSize;
+	size_t arenaAllocated;
+	const char *sourceFile;
+	bool mapped;        // offsets and arena live in a database image
 };
 
-// initializer and destroyer
-TaxonNode *newTaxonNode();
+// lowest common ancestors in constant time. The taxa are numbered in preorder
+// from the root (1), children by increasing taxonID; the LCA of two taxa is
+// the parent of the shallowest taxon numbered after the first up to the
+// second, found with a sparse table over blocks of 64 positions and, within
+// a block, bit masks of the running minima. Taxa whose path to the root is
+// broken hang off the root, as taxonomyPath() ends there too;
+struct lcaIndex_st {
+	IDnum maxTaxonID;
+	int32_t *position;      // preorder position of each taxonID, -1 if not in the tree
+	int32_t *depth;         // of the taxon at each position
+	IDnum *parent;          // of the taxon at each position, 0 for the root
+	uint64_t *blockMasks;   // per position
+	int32_t *blockTable;    // numLevels rows of numBlocks shallowest positions
+	int32_t numPositions;
+	int32_t numBlocks;
+	int numLevels;
+};
 
+// initializer and destroyer
 TaxonTree *newTaxonTree();
 
 void destroyTaxonTree(TaxonTree *tTree);
@@ -54,7 +119,32 @@ TaxonTree *importTaxonTreeFromFile(const char* taxonTreeFile);
 
 TaxonName *importTaxonNameFromFile(const char* taxonNameFile);
 
+// same, from an open reader, which is left open;
+TaxonTree *importTaxonTreeFromReader(LineReader *ncbiTaxonTreeFile);
+
+TaxonName *importTaxonNameFromReader(LineReader *ncbiTaxonNameFile);
+
+// lazy variant of importTaxonNameFromFile, nothing is read until loadTaxonNames;
+TaxonName *openTaxonNameFile(const char* taxonNameFile);
+
+// make sure the names of taxonIDs are loaded, reading the source file once
+// for all of them; a no-op for eagerly loaded or mapped names;
+void loadTaxonNames(TaxonName *tName, const vector<IDnum> &taxonIDs);
+
+// load database from a compiled image (see dbimage.h);
+TaxonTree *importTaxonTreeFromImage(DBImage *image);
+
+TaxonName *importTaxonNameFromImage(DBImage *image);
+
 // utility functions that are useful in runtime
+bool taxonInTree(TaxonTree *tTree, IDnum taxonID);
+
+const char *rankName(TaxonTree *tTree, RankCode rank);
+
+const TaxonLineage *taxonLineage(TaxonTree *tTree, IDnum taxonID);
+
+const char *taxonName(TaxonName *tName, IDnum taxonID);
+
 vector<NameRank> taxonomyPath(TaxonTree *tTree, TaxonName *tNames, IDnum taxonID);
 
 vector<IDRank> taxonomyPathIDRank(TaxonTree *tTree, IDnum taxonID);
@@ -65,4 +155,25 @@ string taxonomyPathString(vector<NameRank> path);
 
 IDnum lowestCommonAncestor(TaxonTree *tTree, IDnum taxonIDA, IDnum taxonIDB);
 
+// number the taxa in preorder, in time linear in the size of the tree, for
+// taxonUnder(); a no-op once done;
+void labelTaxonTree(TaxonTree *tTree);
+
+// whether taxonID is ancestorID or one of its descendants, in O(1) on a
+// labelled tree; false for taxa that are not in the tree;
+bool taxonUnder(const TaxonTree *tTree, IDnum taxonID, IDnum ancestorID);
+
+// built in time linear in the size of the tree, for LCA queries in O(1);
+LCAIndex *buildLCAIndex(TaxonTree *tTree);
+
+void destroyLCAIndex(LCAIndex *index);
+
+// lowestCommonAncestor() through the index: 1 if either taxon is not in
+// the tree;
+IDnum lcaOfPair(const LCAIndex *index, IDnum taxonIDA, IDnum taxonIDB);
+
+// LCA of the taxa of a set that are in the tree, in O(numTaxa); 0 if none
+// is; numFound, if not NULL, receives their number;
+IDnum lcaOfSet(const LCAIndex *index, const IDnum *taxonIDs, size_t numTaxa, size_t *numFound);
+
 #endif
@@ -0,0 +1,196 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "textscan.h"
+#include "instream.h"
+#include "utility.h"
+#include "globals.h"
+
+using namespace std;
+
+MappedFile *mapTextFile(const char *path){
+	InputStream *stream = openInputStream(path);
+	MappedFile *file = callocOrExit(1, MappedFile);
+	file->data = "";
+	
+	struct stat st;
+	int fd = inputStreamFd(stream);
+	if(inputStreamFormat(stream) != INPUT_PLAIN || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+		// compressed data can only be scanned once decoded;
+		size_t allocated = 0;
+		char *data = NULL;
+		while(true){
+			if(file->size == allocated){
+				allocated = (allocated == 0)?(1 << 24):allocated * 2;
+				data = reallocOrExit(data, allocated, char);
+			}
+			size_t numRead = readInputStream(stream, data + file->size, allocated - file->size);
+			if(numRead == 0){
+				break;
+			}
+			file->size += numRead;
+		}
+		file->decoded = true;
+		file->data = data;
+		closeInputStream(stream);
+		return file;
+	}
+	
+	file->size = st.st_size;
+	if(file->size > 0){
+		void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED){
+			cerr << "Could not map database file: " << path << endl;
+			exit(EXIT_FAILURE);
+		}
+		madvise(data, file->size, MADV_SEQUENTIAL);
+		file->data = (const char *) data;
+	}
+	closeInputStream(stream);
+	return file;
+}
+
+void unmapTextFile(MappedFile *file){
+	if(file == NULL){
+		return;
+	}
+	if(file->decoded){
+		free((void *) file->data);
+	}else if(file->size > 0){
+		munmap((void *) file->data, file->size);
+	}
+	free(file);
+}
+
+// initial buffer of a LineReader;
+#define LINE_READER_BUFFER (1 << 20)
+
+LineReader *openLineReader(const char *path, string *error){
+	InputStream *stream = openInputStream(path, error);
+	if(stream == NULL){
+		return NULL;
+	}
+	LineReader *reader = callocOrExit(1, LineReader);
+	reader->stream = stream;
+	reader->capacity = LINE_READER_BUFFER;
+	reader->buffer = mallocOrExit(reader->capacity, char);
+	return reader;
+}
+
+void closeLineReader(LineReader *reader){
+	if(reader == NULL){
+		return;
+	}
+	closeInputStream(reader->stream);
+	free(reader->buffer);
+	free(reader);
+}
+
+const string &lineReaderError(LineReader *reader){
+	return inputStreamError(reader->stream);
+}
+
+bool readLine(LineReader *reader, const char **line, size_t *length){
+	while(true){
+		char *start = reader->buffer + reader->begin;
+		char *newline = (char *) memchr(reader->buffer + reader->scanned, '\n', reader->end - reader->scanned);
+		if(newline != NULL){
+			*line = start;
+			*length = newline - start;
+			reader->begin = reader->scanned = newline + 1 - reader->buffer;
+			return true;
+		}
+		reader->scanned = reader->end;
+		
+		// the last line may lack its newline;
+		if(reader->eof){
+			if(reader->begin == reader->end){
+				return false;
+			}
+			*line = start;
+			*length = reader->end - reader->begin;
+			reader->begin = reader->scanned = reader->end;
+			return true;
+		}
+		
+		// keep the partial line at the front, grow the buffer if it fills it;
+		if(reader->begin > 0){
+			memmove(reader->buffer, start, reader->end - reader->begin);
+			reader->end -= reader->begin;
+			reader->scanned = reader->end;
+			reader->begin = 0;
+		}
+		if(reader->end == reader->capacity){
+			reader->capacity *= 2;
+			reader->buffer = reallocOrExit(reader->buffer, reader->capacity, char);
+		}
+		size_t numRead = readInputStream(reader->stream, reader->buffer + reader->end, reader->capacity - reader->end);
+		if(numRead == 0){
+			reader->eof = true;
+		}
+		reader->end += numRead;
+	}
+}
+
+size_t alignToLine(const char *data, size_t size, size_t pos){
+	if(pos == 0 || pos >= size){
+		return (pos >= size)?size:0;
+	}
+	if(data[pos-1] == '\n'){
+		return pos;
+	}
+	return nextLine(data + pos, data + size) - data;
+}
+
+vector<size_t> chunkBoundaries(MappedFile *file, int numChunks, size_t minChunkSize, RecordAligner align){
+	vector<size_t> boundaries;
+	if(numChunks < 1){
+		numChunks = 1;
+	}
+	if(minChunkSize > 0 && file->size / minChunkSize < (size_t) numChunks){
+		numChunks = file->size / minChunkSize;
+		if(numChunks < 1){
+			numChunks = 1;
+		}
+	}
+
+	boundaries.push_back(0);
+	for(int chunk = 1; chunk < numChunks; chunk++){
+		size_t pos = align(file->data, file->size, file->size / numChunks * chunk);
+		if(pos > boundaries.back()){
+			boundaries.push_back(pos);
+		}
+	}
+	if(boundaries.back() != file->size){
+		boundaries.push_back(file->size);
+	}
+	return boundaries;
+}
+
+void scanChunksInParallel(int numChunks, void (*scan)(int chunk, void *arg), void *arg){
+	vector<thread> workers;
+	for(int chunk = 1; chunk < numChunks; chunk++){
+		workers.push_back(thread(scan, chunk, arg));
+	}
+	if(numChunks > 0){
+		scan(0, arg);
+	}
+	for(unsigned int index = 0; index < workers.size(); index++){
+		workers[index].join();
+	}
+}
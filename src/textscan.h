@@ -0,0 +1,179 @@
+/*
+
+	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+    Konstantinidis Lab, Georgia Institute of Technology, 2013
+
+*/
+
+#ifndef _TEXTSCAN_H_
+#define _TEXTSCAN_H_
+
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include "globals.h"
+
+using namespace std;
+
+// Read-only mapping of a text library, scanned in place by the loaders. Large
+// files are cut into byte ranges that start on record boundaries and scanned
+// by several threads.
+
+// smallest byte range worth a thread of its own;
+#define MIN_SCAN_CHUNK (4 << 20)
+
+struct mappedFile_st {
+	const char *data;
+	size_t size;
+	bool decoded;       // compressed file, decoded into memory
+};
+
+// buffered reading of a text file (or stdin, possibly compressed, see
+// instream.h) line by line; lines are returned in place in the buffer, which
+// grows to hold the longest line;
+struct lineReader_st {
+	InputStream *stream;
+	char *buffer;
+	size_t capacity;
+	size_t begin;       // first unread byte
+	size_t scanned;     // no newline in [begin, scanned)
+	size_t end;         // end of the data read so far
+	bool eof;
+};
+
+// a field of a line, [begin, end);
+struct textField_st {
+	const char *begin;
+	const char *end;
+};
+
+// map a file read-only, or decode it into memory if it is compressed; exits
+// with an error message if it cannot be opened;
+MappedFile *mapTextFile(const char *path);
+
+void unmapTextFile(MappedFile *file);
+
+// exits with an error message if the file cannot be opened or read, unless
+// error is given: see openInputStream();
+LineReader *openLineReader(const char *path, string *error = NULL);
+
+// the next line, without its newline; it stays valid until the next call;
+// false at the end of the file, or on an error kept for lineReaderError();
+bool readLine(LineReader *reader, const char **line, size_t *length);
+
+// the read or decoding error that ended the file, empty if none;
+const string &lineReaderError(LineReader *reader);
+
+void closeLineReader(LineReader *reader);
+
+// a record aligner returns the first record start at or after pos (or size);
+typedef size_t (*RecordAligner)(const char *data, size_t size, size_t pos);
+
+// first line start at or after pos;
+size_t alignToLine(const char *data, size_t size, size_t pos);
+
+// cut a file into at most numChunks ranges of at least minChunkSize bytes;
+// boundaries[i] and boundaries[i+1] delimit range i, each boundary but the
+// first is a record start found by align;
+vector<size_t> chunkBoundaries(MappedFile *file, int numChunks, size_t minChunkSize, RecordAligner align);
+
+// run scan(chunk, arg) for every chunk, each on its own thread;
+void scanChunksInParallel(int numChunks, void (*scan)(int chunk, void *arg), void *arg);
+
+// start of the line following p, or end;
+static inline const char *nextLine(const char *p, const char *end){
+	const char *newline = (const char *) memchr(p, '\n', end - p);
+	return (newline == NULL)?end:newline + 1;
+}
+
+// parse an integer like atoi() would, without reading past end; returns the
+// position after the digits, or NULL if there are none;
+static inline const char *parseIntField(const char *p, const char *end, long *value){
+	while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')){
+		p++;
+	}
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+')){
+		negative = (*p == '-');
+		p++;
+	}
+	if(p == end || *p < '0' || *p > '9'){
+		return NULL;
+	}
+	long v = 0;
+	while(p < end && *p >= '0' && *p <= '9'){
+		v = v * 10 + (*p - '0');
+		p++;
+	}
+	*value = negative?-v:v;
+	return p;
+}
+
+// split [p, end) at delim into at most maxFields fields, the last one ending
+// at the next delim; returns the number of fields found;
+static inline int splitFields(const char *p, const char *end, char delim, TextField *fields, int maxFields){
+	int numFields = 0;
+	while(numFields < maxFields){
+		const char *fieldEnd = (const char *) memchr(p, delim, end - p);
+		fields[numFields].begin = p;
+		fields[numFields].end = (fieldEnd == NULL)?end:fieldEnd;
+		numFields++;
+		if(fieldEnd == NULL){
+			break;
+		}
+		p = fieldEnd + 1;
+	}
+	return numFields;
+}
+
+// parse a number like atof() would, without reading past end; plain decimals
+// of up to 15 digits are exact as one division of two exact doubles, anything
+// else (exponents, long mantissas, inf/nan) goes through strtod();
+static inline double parseFloatField(const char *p, const char *end){
+	static const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+		1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+	const char *start = p;
+	while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')){
+		p++;
+	}
+	bool negative = false;
+	if(p < end && (*p == '-' || *p == '+')){
+		negative = (*p == '-');
+		p++;
+	}
+	long long mantissa = 0;
+	int numDigits = 0;
+	int scale = -1;
+	for(; p < end; p++){
+		if(*p >= '0' && *p <= '9'){
+			mantissa = mantissa * 10 + (*p - '0');
+			numDigits++;
+			if(scale >= 0){
+				scale++;
+			}
+		}else if(*p == '.' && scale < 0){
+			scale = 0;
+		}else{
+			break;
+		}
+	}
+	if(numDigits == 0 || numDigits > 15 || (p < end && (*p == 'e' || *p == 'E' || *p == 'x' || *p == 'X'))){
+		char copy[64];
+		size_t length = end - start;
+		if(length >= sizeof(copy)){
+			length = sizeof(copy) - 1;
+		}
+		memcpy(copy, start, length);
+		copy[length] = '\0';
+		return strtod(copy, NULL);
+	}
+	double value = (double) mantissa;
+	if(scale > 0){
+		value /= powersOf10[scale];
+	}
+	return negative?-value:value;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+#	This file is part of MeTaxa by Chengwei Luo (luo.chengwei@gatech.edu)
+#	Konstantinidis Lab, Georgia Institute of Technology, 2013
+#
+# a truncated gzip job must fail on its own and leave the server serving;
+# run from the MyTaxa directory after make, as "make test" does;
+
+MYTAXA=${1:-./MyTaxa}
+WORK=$(mktemp -d)
+SERVER=
+cleanup(){
+	[ -n "$SERVER" ] && kill $SERVER 2>/dev/null
+	rm -rf "$WORK"
+}
+trap cleanup EXIT
+fail(){
+	echo "FAIL: $1"
+	exit 1
+}
+
+# a database of one taxon next to a copy of the binary, which looks for db/
+# beside itself;
+cp "$MYTAXA" "$WORK/MyTaxa" || fail "no $MYTAXA, run make first"
+mkdir "$WORK/db"
+printf '1\t1\tno rank\n' > "$WORK/db/ncbiNodes.lib"
+printf '1\troot\n' > "$WORK/db/ncbiSciNames.lib"
+: > "$WORK/db/geneTaxon.lib"
+: > "$WORK/db/geneInfo.lib"
+"$WORK/MyTaxa" build-db "$WORK/db" > /dev/null || fail "build-db"
+
+"$WORK/MyTaxa" serve > "$WORK/serve.log" 2>&1 &
+SERVER=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	[ -S "$WORK/db/MyTaxa.sock" ] && break
+	sleep 1
+done
+[ -S "$WORK/db/MyTaxa.sock" ] || fail "server did not start"
+
+gzip -c example/example.mytaxa.input.txt | head -c 2000 > "$WORK/trunc.gz"
+if "$WORK/MyTaxa" client "$WORK/trunc.gz" "$WORK/trunc.out" 0.5 2> "$WORK/client.log"; then
+	fail "truncated input reported as classified"
+fi
+grep -q "^ERROR" "$WORK/client.log" || fail "no ERROR answer: $(cat "$WORK/client.log")"
+kill -0 $SERVER 2>/dev/null || fail "server exited: $(cat "$WORK/serve.log")"
+
+"$WORK/MyTaxa" client example/example.mytaxa.input.txt "$WORK/good.out" 0.5 || fail "job after the bad one"
+[ -s "$WORK/good.out" ] || fail "empty output after the bad job"
+echo "PASS: serve survives a truncated gzip job"